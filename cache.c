@@ -0,0 +1,560 @@
+/*
+	Copyright(C) 2016, Red Hat, Inc., Stanislav Kozina
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * The cache file starts with the magic and the params it was generated
+ * with, followed by the entries of the module in the order they were
+ * generated. The objects are stored in preorder. The reffile objects are
+ * stored by the key of the record they reference and pointed back to the
+ * records when the file is read.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "main.h"
+#include "utils.h"
+#include "hash.h"
+#include "stack.h"
+#include "record.h"
+#include "cache.h"
+
+#define	CACHE_MAGIC	"kabi-dw cache 2\n"
+
+#define	CACHE_NULL	((uint32_t)-1)
+
+/* Sanity limit for the strings read back */
+#define	CACHE_STR_MAX	(1 << 20)
+
+static void cache_write_u32(FILE *f, uint32_t v)
+{
+	if (fwrite(&v, sizeof(v), 1, f) != 1)
+		fail("Cannot write to the cache file: %m\n");
+}
+
+static void cache_write_u64(FILE *f, uint64_t v)
+{
+	if (fwrite(&v, sizeof(v), 1, f) != 1)
+		fail("Cannot write to the cache file: %m\n");
+}
+
+static void cache_write_str(FILE *f, const char *s)
+{
+	size_t len;
+
+	if (s == NULL) {
+		cache_write_u32(f, CACHE_NULL);
+		return;
+	}
+
+	len = strlen(s);
+	cache_write_u32(f, len);
+	if (len > 0 && fwrite(s, len, 1, f) != 1)
+		fail("Cannot write to the cache file: %m\n");
+}
+
+static void cache_write_obj(FILE *f, obj_t *o)
+{
+	obj_t **l;
+
+	if (o == NULL) {
+		cache_write_u32(f, CACHE_NULL);
+		return;
+	}
+
+	cache_write_u32(f, o->type);
+	cache_write_u32(f, o->is_bitfield | o->first_bit << 8 |
+			o->last_bit << 16);
+	if (o->type == __type_reffile) {
+		cache_write_str(f, NULL);
+		cache_write_str(f, record_get_key(o->ref_record));
+	} else {
+		cache_write_str(f, o->name);
+		cache_write_str(f, o->base_type);
+	}
+	cache_write_u32(f, o->alignment);
+	cache_write_u32(f, o->byte_size);
+	if (is_weak(o)) {
+		cache_write_str(f, o->link);
+	} else if (o->type != __type_reffile) {
+		cache_write_u64(f, o->offset);
+	}
+	cache_write_str(f, o->ns);
+
+	if (o->member_list == NULL) {
+		cache_write_u32(f, CACHE_NULL);
+	} else {
+		cache_write_u32(f, o->member_list->cnt);
+		for (l = o->member_list->members; *l; l++)
+			cache_write_obj(f, *l);
+	}
+
+	cache_write_obj(f, o->ptr);
+}
+
+static bool cache_read_u32(FILE *f, uint32_t *v)
+{
+	return fread(v, sizeof(*v), 1, f) == 1;
+}
+
+static bool cache_read_u64(FILE *f, uint64_t *v)
+{
+	return fread(v, sizeof(*v), 1, f) == 1;
+}
+
+static bool cache_read_str(FILE *f, char **s)
+{
+	uint32_t len;
+
+	if (!cache_read_u32(f, &len))
+		return false;
+
+	if (len == CACHE_NULL) {
+		*s = NULL;
+		return true;
+	}
+
+	if (len > CACHE_STR_MAX)
+		return false;
+
+	*s = safe_zmalloc(len + 1);
+	if (len > 0 && fread(*s, len, 1, f) != 1) {
+		free(*s);
+		return false;
+	}
+
+	return true;
+}
+
+static bool cache_read_interned(FILE *f, const char **s)
+{
+	char *str;
+
+	if (!cache_read_str(f, &str))
+		return false;
+
+	*s = global_string_get_move(str);
+	return true;
+}
+
+static bool cache_read_obj(FILE *f, obj_t **res)
+{
+	obj_t *o;
+	uint32_t type, bits, cnt, i;
+	uint64_t value;
+
+	*res = NULL;
+
+	if (!cache_read_u32(f, &type))
+		return false;
+	if (type == CACHE_NULL)
+		return true;
+	if (type >= NR_OBJ_TYPES)
+		return false;
+
+	o = obj_new(type, NULL);
+	/* Hand the partial tree to the caller, so it can free it */
+	*res = o;
+
+	if (!cache_read_u32(f, &bits))
+		return false;
+	o->is_bitfield = bits & 0xff;
+	o->first_bit = (bits >> 8) & 0xff;
+	o->last_bit = (bits >> 16) & 0xff;
+
+	if (!cache_read_interned(f, &o->name) ||
+	    !cache_read_interned(f, &o->base_type))
+		return false;
+	if (!cache_read_u32(f, &o->alignment) ||
+	    !cache_read_u32(f, &o->byte_size))
+		return false;
+	if (is_weak(o)) {
+		if (!cache_read_interned(f, &o->link))
+			return false;
+	} else if (o->type != __type_reffile) {
+		if (!cache_read_u64(f, &value))
+			return false;
+		o->offset = value;
+	}
+	if (!cache_read_str(f, &o->ns))
+		return false;
+
+	if (!cache_read_u32(f, &cnt))
+		return false;
+	if (cnt != CACHE_NULL) {
+		for (i = 0; i < cnt; i++) {
+			obj_t *member;
+			bool ok = cache_read_obj(f, &member);
+
+			if (member != NULL) {
+				member->parent = o;
+				o->member_list = obj_list_add(o->member_list,
+							      member);
+			}
+			if (!ok || member == NULL)
+				return false;
+		}
+	}
+
+	if (!cache_read_obj(f, &o->ptr))
+		return false;
+	if (o->ptr != NULL)
+		o->ptr->parent = o;
+
+	return true;
+}
+
+/*
+ * Cache file entries. The records of a CU are stored together, so the
+ * references between them can be resolved when reading them back.
+ */
+enum {
+	CACHE_ENTRY_CU = 1,
+	CACHE_ENTRY_RECORD,
+	CACHE_ENTRY_MARK,
+	CACHE_ENTRY_END,
+};
+
+enum {
+	CACHE_RECORD_REGULAR = 1,
+	CACHE_RECORD_ASSEMBLY,
+	CACHE_RECORD_WEAK,
+};
+
+/* Initial size of the hash of the records of a CU read back */
+#define	CACHE_CU_SIZE	1024
+
+FILE *cache_create(const char *path, const char *params)
+{
+	FILE *f;
+
+	f = fopen(path, "w");
+	if (f == NULL)
+		fail("Cannot create cache file %s: %m\n", path);
+
+	if (fwrite(CACHE_MAGIC, strlen(CACHE_MAGIC), 1, f) != 1)
+		fail("Cannot write to the cache file: %m\n");
+	cache_write_str(f, params);
+
+	return f;
+}
+
+void cache_close(FILE *f, const char *path)
+{
+	cache_write_u32(f, CACHE_ENTRY_END);
+	if (fclose(f) != 0)
+		fail("Cannot write cache file %s: %m\n", path);
+}
+
+static void cache_write_stack_cb(void *data, void *arg)
+{
+	cache_write_str(arg, data);
+}
+
+static void cache_write_record_data(FILE *f, struct record *rec)
+{
+	if (rec->dump == record_dump_assembly) {
+		cache_write_u32(f, CACHE_RECORD_ASSEMBLY);
+		cache_write_str(f, rec->key);
+		return;
+	}
+
+	if (rec->dump == record_dump_weak) {
+		cache_write_u32(f, CACHE_RECORD_WEAK);
+		cache_write_str(f, rec->key);
+		cache_write_str(f, rec->link);
+		return;
+	}
+
+	cache_write_u32(f, CACHE_RECORD_REGULAR);
+	cache_write_str(f, rec->key);
+	cache_write_str(f, rec->origin);
+	cache_write_str(f, rec->cu);
+	cache_write_u32(f, rec->stack->st_count);
+	walk_stack(rec->stack, cache_write_stack_cb, f);
+	cache_write_obj(f, rec->obj);
+}
+
+void cache_write_cu(FILE *f, struct hash *cu_db)
+{
+	struct hash_iter iter;
+	const void *val;
+
+	cache_write_u32(f, CACHE_ENTRY_CU);
+	cache_write_u32(f, hash_get_count(cu_db));
+	hash_iter_init(cu_db, &iter);
+	while (hash_iter_next(&iter, NULL, &val))
+		cache_write_record_data(f, (struct record *)val);
+}
+
+void cache_write_record(FILE *f, struct record *rec)
+{
+	cache_write_u32(f, CACHE_ENTRY_RECORD);
+	cache_write_record_data(f, rec);
+}
+
+void cache_write_mark(FILE *f, const char *name)
+{
+	cache_write_u32(f, CACHE_ENTRY_MARK);
+	cache_write_str(f, name);
+}
+
+static void cache_cu_db_free(struct hash *cu_db)
+{
+	struct hash_iter iter;
+	const void *val;
+
+	hash_iter_init(cu_db, &iter);
+	while (hash_iter_next(&iter, NULL, &val))
+		record_put((struct record *)val);
+	hash_free(cu_db);
+}
+
+struct cache_resolve_ctx {
+	struct cache_resolver *resolver;
+	struct hash *cu_db;
+	bool failed;
+};
+
+/* Point the reffiles read from the cache back to the records */
+static int cache_resolve_cb(obj_t *o, void *arg)
+{
+	struct cache_resolve_ctx *ctx = arg;
+	const char *prefix = DECLARATION_PATH "/";
+	const char *key = o->base_type;
+	struct record *rec;
+
+	if (o->type != __type_reffile)
+		return CB_CONT;
+
+	if (key == NULL) {
+		ctx->failed = true;
+		return CB_FAIL;
+	}
+
+	if (strncmp(key, prefix, strlen(prefix)) == 0) {
+		rec = ctx->resolver->decl(key + strlen(prefix),
+					  ctx->resolver->arg);
+	} else {
+		rec = hash_find(ctx->cu_db, key);
+		if (rec == NULL) {
+			ctx->failed = true;
+			return CB_FAIL;
+		}
+		ilist_add_tail(&rec->dependents, &o->depend_link);
+	}
+	o->ref_record = rec;
+	o->base_type = NULL;
+
+	return CB_CONT;
+}
+
+static bool cache_read_record_regular(FILE *f, struct record *rec)
+{
+	uint32_t cnt, i;
+	struct arena *prev;
+	char *str;
+	obj_t *obj;
+	bool ok;
+
+	if (!cache_read_str(f, &str) || str == NULL)
+		return false;
+	rec->origin = global_string_get_move(str);
+
+	if (!cache_read_str(f, &rec->cu) || !cache_read_u32(f, &cnt))
+		return false;
+
+	for (i = 0; i < cnt; i++) {
+		if (!cache_read_str(f, &str) || str == NULL)
+			return false;
+		stack_push(rec->stack, str);
+	}
+
+	prev = obj_arena_set(&rec->arena);
+	ok = cache_read_obj(f, &obj);
+	obj_arena_set(prev);
+	if (obj != NULL)
+		record_close(rec, obj);
+
+	return ok && obj != NULL;
+}
+
+static struct record *cache_read_record(FILE *f)
+{
+	struct record *rec = NULL;
+	uint32_t kind;
+	char *key, *link;
+
+	if (!cache_read_u32(f, &kind) || !cache_read_str(f, &key))
+		return NULL;
+	if (key == NULL)
+		return NULL;
+
+	switch (kind) {
+	case CACHE_RECORD_REGULAR:
+		rec = record_new_regular(key);
+		if (!cache_read_record_regular(f, rec)) {
+			record_put(rec);
+			rec = NULL;
+		}
+		break;
+	case CACHE_RECORD_ASSEMBLY:
+		rec = record_new_assembly(key);
+		break;
+	case CACHE_RECORD_WEAK:
+		if (cache_read_str(f, &link) && link != NULL) {
+			rec = record_new_weak(key, link);
+			free(link);
+		}
+		break;
+	}
+
+	free(key);
+	return rec;
+}
+
+static struct hash *cache_read_cu(FILE *f, struct cache_resolver *resolver)
+{
+	struct hash *cu_db = hash_new(CACHE_CU_SIZE, NULL);
+	struct cache_resolve_ctx ctx;
+	struct hash_iter iter;
+	const void *val;
+	struct record *rec;
+	uint32_t cnt, i;
+
+	if (!cache_read_u32(f, &cnt))
+		goto fail;
+
+	for (i = 0; i < cnt; i++) {
+		rec = cache_read_record(f);
+		if (rec == NULL)
+			goto fail;
+		if (rec->dump != record_dump_regular ||
+		    hash_find(cu_db, rec->key) != NULL) {
+			record_put(rec);
+			goto fail;
+		}
+		hash_add(cu_db, rec->key, rec);
+	}
+
+	ctx.resolver = resolver;
+	ctx.cu_db = cu_db;
+	ctx.failed = false;
+	hash_iter_init(cu_db, &iter);
+	while (hash_iter_next(&iter, NULL, &val)) {
+		rec = (struct record *)val;
+		obj_walk_tree(rec->obj, cache_resolve_cb, &ctx);
+		if (ctx.failed)
+			goto fail;
+	}
+
+	return cu_db;
+fail:
+	cache_cu_db_free(cu_db);
+	return NULL;
+}
+
+static bool cache_read_entries(FILE *f, const char *params,
+			       struct cache_resolver *resolver,
+			       struct cache_load *load)
+{
+	char magic[sizeof(CACHE_MAGIC) - 1];
+	struct hash *cu_db;
+	struct record *rec;
+	uint32_t entry;
+	void *mark;
+	char *str;
+	bool same;
+
+	if (fread(magic, sizeof(magic), 1, f) != 1 ||
+	    memcmp(magic, CACHE_MAGIC, sizeof(magic)) != 0)
+		return false;
+
+	if (!cache_read_str(f, &str) || str == NULL)
+		return false;
+	same = strcmp(str, params) == 0;
+	free(str);
+	if (!same)
+		return false;
+
+	while (cache_read_u32(f, &entry)) {
+		switch (entry) {
+		case CACHE_ENTRY_CU:
+			cu_db = cache_read_cu(f, resolver);
+			if (cu_db == NULL)
+				return false;
+			list_add(&load->cu_dbs, cu_db);
+			break;
+		case CACHE_ENTRY_RECORD:
+			rec = cache_read_record(f);
+			if (rec == NULL)
+				return false;
+			list_add(&load->records, rec);
+			/* Only the CUs may contain references to records */
+			if (rec->dump == record_dump_regular)
+				return false;
+			break;
+		case CACHE_ENTRY_MARK:
+			if (!cache_read_str(f, &str) || str == NULL)
+				return false;
+			mark = resolver->mark(str, resolver->arg);
+			free(str);
+			if (mark == NULL)
+				return false;
+			list_add(&load->marks, mark);
+			break;
+		case CACHE_ENTRY_END:
+			return fgetc(f) == EOF;
+		default:
+			return false;
+		}
+	}
+
+	return false;
+}
+
+void cache_load_init(struct cache_load *load)
+{
+	list_init(&load->cu_dbs, NULL);
+	list_init(&load->records, NULL);
+	list_init(&load->marks, NULL);
+}
+
+void cache_load_clear(struct cache_load *load)
+{
+	list_clear(&load->cu_dbs);
+	list_clear(&load->records);
+	list_clear(&load->marks);
+}
+
+bool cache_read(FILE *f, const char *params, struct cache_resolver *resolver,
+		struct cache_load *load)
+{
+	struct list_node *iter;
+
+	if (cache_read_entries(f, params, resolver, load))
+		return true;
+
+	LIST_FOR_EACH(&load->cu_dbs, iter)
+		cache_cu_db_free(list_node_data(iter));
+	LIST_FOR_EACH(&load->records, iter)
+		record_put(list_node_data(iter));
+	cache_load_clear(load);
+
+	return false;
+}
@@ -0,0 +1,64 @@
+/*
+	Copyright(C) 2016, Red Hat, Inc., Stanislav Kozina
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * The generate cache: the results of a module stored in a binary file and
+ * replayed instead of processing the module again.
+ * The files are meant to be read back by the same build of the tool on the
+ * same machine, so the values are stored in the host byte order. The build
+ * is identified by the hash of the binary in the cache params.
+ */
+
+#ifndef CACHE_H_
+#define	CACHE_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "list.h"
+
+struct hash;
+struct record;
+
+/* Results read from a cache file, in the order they were written */
+struct cache_load {
+	struct list cu_dbs;	/* Records of the CUs, hashed by the key */
+	struct list records;	/* Records outside of the CUs */
+	struct list marks;	/* Marks returned by cache_resolver.mark */
+};
+
+/* Lookups of the names in the cache file, NULL makes the file invalid */
+struct cache_resolver {
+	struct record *(*decl)(const char *key, void *arg);
+	void *(*mark)(const char *name, void *arg);
+	void *arg;
+};
+
+extern FILE *cache_create(const char *path, const char *params);
+extern void cache_close(FILE *, const char *path);
+extern void cache_write_cu(FILE *, struct hash *);
+extern void cache_write_record(FILE *, struct record *);
+extern void cache_write_mark(FILE *, const char *);
+
+extern void cache_load_init(struct cache_load *);
+/* Drops the nodes, not the results */
+extern void cache_load_clear(struct cache_load *);
+/* On failure the results read so far are freed */
+extern bool cache_read(FILE *, const char *params, struct cache_resolver *,
+		       struct cache_load *);
+
+#endif /* CACHE_H_ */
@@ -32,6 +32,7 @@
 #include "objects.h"
 #include "utils.h"
 #include "compare.h"
+#include "kabipack.h"
 
 /* diff -u style prefix for tree comparison */
 #define ADD_PREFIX "+"
@@ -75,18 +76,18 @@ static bool is_duplicate(char *filename)
 }
 
 static void _print_node_list(const char *s, const char *prefix,
-			     obj_list_t *list, obj_list_t *last, FILE *stream) {
-	obj_list_t *l = list;
+			     obj_t **list, obj_t **last, FILE *stream) {
+	obj_t **l = list;
 
 	fprintf(stream, "%s:\n", s);
-	while (l && l != last) {
-		obj_print_tree__prefix(l->member, prefix, stream);
-		l = l->next;
+	while (*l && l != last) {
+		obj_print_tree__prefix(*l, prefix, stream);
+		l++;
 	}
 }
 
 static void print_node_list(const char *s, const char *prefix,
-			    obj_list_t *list, FILE *stream) {
+			    obj_t **list, FILE *stream) {
 	_print_node_list(s, prefix, list, NULL, stream);
 }
 
@@ -229,18 +230,18 @@ typedef enum {
  * list2, the first element of list2 in list1 or the first line where
  * list1 and list2 do not differ, whichever comes first.
  */
-static diff_ret_t list_diff(obj_list_t *list1, obj_list_t **next1,
-			    obj_list_t *list2, obj_list_t **next2)
+static diff_ret_t list_diff(obj_t **list1, obj_t ***next1,
+			    obj_t **list2, obj_t ***next2)
 {
-	obj_t *o1 = list2->member, *o2 = list1->member, *o = o1;
+	obj_t *o1 = *list2, *o2 = *list1, *o = o1;
 	int d1 = 0, d2 = 0, ret;
-	obj_list_t *next;
+	obj_t **next;
 
 	next = *next1 = list1;
 	*next2 = list2;
 
-	while (next) {
-		ret = _cmp_nodes(o, next->member, true);
+	while (*next) {
+		ret = _cmp_nodes(o, *next, true);
 		if (ret == CMP_SAME || ret == CMP_OFFSET
 		    || ret == CMP_ALIGNMENT) {
 			if (o == o1)
@@ -253,8 +254,7 @@ static diff_ret_t list_diff(obj_list_t *list1, obj_list_t **next1,
 		}
 
 		if (d1 == d2)  {
-			ret = _cmp_nodes((*next1)->member, (*next2)->member,
-					 true);
+			ret = _cmp_nodes(**next1, **next2, true);
 			if (ret == CMP_SAME || ret == CMP_OFFSET
 			    || ret == CMP_ALIGNMENT) {
 				/* d1 fields have been replaced */
@@ -263,12 +263,12 @@ static diff_ret_t list_diff(obj_list_t *list1, obj_list_t **next1,
 
 		}
 
-		if (!(*next1) || !((*next1)->next) || (d2  < d1)) {
-			next = *next2 = (*next2)->next;
+		if (!(**next1) || !((*next1)[1]) || (d2  < d1)) {
+			next = *next2 = *next2 + 1;
 			o = o2;
 			d2++;
 		} else {
-			next = *next1 = (*next1)->next;
+			next = *next1 = *next1 + 1;
 			o = o1;
 			d1++;
 		}
@@ -316,6 +316,8 @@ typedef struct compare_config_s {
 	int follow;
 	char *old_dir;
 	char *new_dir;
+	struct kabipack *old_pack; /* Set if old_dir is a kABI pack */
+	struct kabipack *new_pack; /* Set if new_dir is a kABI pack */
 	char *filename;
 	char **flist;
 	int flistsz;
@@ -335,7 +337,7 @@ typedef struct compare_config_s {
 } compare_config_t;
 
 compare_config_t compare_config = {false, false, false, false, 0,
-				   NULL, NULL, NULL, NULL,
+				   NULL, NULL, NULL, NULL, NULL, NULL,
 				   0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
 static void message_alignment_value(unsigned v, FILE *stream)
@@ -405,7 +407,7 @@ static void message_namespace(obj_t *o1, obj_t *o2, FILE *stream)
 
 static int _compare_tree(obj_t *o1, obj_t *o2, FILE *stream)
 {
-	obj_list_t *list1 = NULL, *list2 = NULL;
+	obj_t **list1 = obj_members(o1), **list2 = obj_members(o2);
 	int ret = COMP_SAME, tmp;
 
 	tmp = cmp_nodes(o1, o2);
@@ -435,15 +437,10 @@ static int _compare_tree(obj_t *o1, obj_t *o2, FILE *stream)
 			return ret;
 	}
 
-	if (o1->member_list)
-		list1 = o1->member_list->first;
-	if (o2->member_list)
-		list2 = o2->member_list->first;
-
-	while (list1 && list2) {
-		if (cmp_nodes(list1->member, list2->member) == CMP_DIFF) {
+	while (*list1 && *list2) {
+		if (cmp_nodes(*list1, *list2) == CMP_DIFF) {
 			int index;
-			obj_list_t *next1, *next2;
+			obj_t **next1, **next2;
 
 			index = list_diff(list1, &next1, list2, &next2);
 
@@ -478,12 +475,12 @@ static int _compare_tree(obj_t *o1, obj_t *o2, FILE *stream)
 			}
 		}
 
-		tmp =_compare_tree(list1->member, list2->member, stream);
+		tmp =_compare_tree(*list1, *list2, stream);
 		ret = comp_return_value(ret, tmp);
 
-		list1 = list1->next;
-		list2 = list2->next;
-		if (!list1 && list2) {
+		list1++;
+		list2++;
+		if (!*list1 && *list2) {
 			if (!compare_config.no_added) {
 				print_node_list("Added", ADD_PREFIX,
 						list2, stream);
@@ -491,7 +488,7 @@ static int _compare_tree(obj_t *o1, obj_t *o2, FILE *stream)
 			}
 			return ret;
 		}
-		if (list1 && !list2) {
+		if (*list1 && !*list2) {
 			if (!compare_config.no_removed) {
 				print_node_list("Removed", DEL_PREFIX,
 						list1, stream);
@@ -560,6 +557,7 @@ static void compare_usage()
 	printf("Usage:\n"
 	       "\tcompare [options] kabi_dir kabi_dir [kabi_file...]\n"
 	       "\tcompare [options] kabi_file kabi_file\n"
+	       "\nEach kabi_dir can also be a kABI pack written by generate.\n"
 	       "\nOptions:\n"
 	       "    -h, --help:\t\tshow this message\n"
 	       "    -k, --hide-kabi:\thide changes made by RH_KABI_REPLACE()\n"
@@ -589,6 +587,42 @@ static void compare_usage()
 	exit(1);
 }
 
+/*
+ * Does the kABI file exist in the directory or the pack?
+ * path is the file in the directory, filename is relative to it.
+ */
+static bool kabi_file_exists(struct kabipack *pack, const char *path,
+			     const char *filename)
+{
+	struct stat fstat;
+
+	if (pack != NULL)
+		return kabipack_find(pack, filename) != -1;
+
+	if (stat(path, &fstat) == 0)
+		return true;
+
+	if (errno != ENOENT)
+		fail("Failed to stat() file%s: %s\n", path, strerror(errno));
+
+	return false;
+}
+
+static FILE *kabi_file_open(struct kabipack *pack, char *path,
+			    const char *filename)
+{
+	ssize_t i;
+
+	if (pack == NULL)
+		return safe_fopen(path);
+
+	i = kabipack_find(pack, filename);
+	if (i == -1)
+		fail("Failed to open kABI file: %s\n", path);
+
+	return kabipack_fopen(pack, i);
+}
+
 /*
  * Parse two files and compare the resulting tree.
  *
@@ -603,12 +637,12 @@ static int compare_two_files(const char *filename, const char *newfile,
 			     bool follow)
 {
 	obj_t *root1, *root2;
+	struct arena arena1, arena2;
 	char *old_dir = compare_config.old_dir;
 	char *new_dir = compare_config.new_dir;
 	char *path1, *path2, *s = NULL;
 	const char *filename2;
 	FILE *file1, *file2, *stream;
-	struct stat fstat;
 	size_t sz;
 	int ret = 0, tmp;
 
@@ -623,32 +657,28 @@ static int compare_two_files(const char *filename, const char *newfile,
 	filename2 = newfile ? newfile : filename;
 	safe_asprintf(&path2, "%s/%s", new_dir, filename2);
 
-	if (stat(path2, &fstat) != 0) {
-		if (errno == ENOENT) {
-			/* Don't consider an incomplete definition a change */
-			if (strncmp(filename2, DECLARATION_PATH,
-				    strlen(DECLARATION_PATH)) &&
-			    !compare_config.no_moved_files) {
-				ret = EXIT_KABI_CHANGE;
-				printf("Symbol removed or moved: %s\n",
-				       filename);
-			}
+	if (!kabi_file_exists(compare_config.new_pack, path2, filename2)) {
+		/* Don't consider an incomplete definition a change */
+		if (strncmp(filename2, DECLARATION_PATH,
+			    strlen(DECLARATION_PATH)) &&
+		    !compare_config.no_moved_files) {
+			ret = EXIT_KABI_CHANGE;
+			printf("Symbol removed or moved: %s\n", filename);
+		}
 
-			free(path1);
-			free(path2);
+		free(path1);
+		free(path2);
 
-			return ret;
-		} else {
-			fail("Failed to stat() file%s: %s\n",
-			     path2, strerror(errno));
-		}
+		return ret;
 	}
 
-	file1 = safe_fopen(path1);
-	file2 = safe_fopen(path2);
+	file1 = kabi_file_open(compare_config.old_pack, path1, filename);
+	file2 = kabi_file_open(compare_config.new_pack, path2, filename2);
 
-	root1 = obj_parse(file1, path1);
-	root2 = obj_parse(file2, path2);
+	arena_init(&arena1, OBJ_ARENA_CHUNK_SIZE);
+	arena_init(&arena2, OBJ_ARENA_CHUNK_SIZE);
+	root1 = obj_parse(file1, path1, &arena1);
+	root2 = obj_parse(file2, path2, &arena2);
 
 	free(path1);
 	free(path2);
@@ -682,8 +712,8 @@ static int compare_two_files(const char *filename, const char *newfile,
 		ret = EXIT_KABI_CHANGE;
 	}
 
-	obj_free(root1);
-	obj_free(root2);
+	arena_free(&arena1);
+	arena_free(&arena2);
 	fclose(file1);
 	fclose(file2);
 	fclose(stream);
@@ -713,6 +743,33 @@ static walk_rv_t compare_files_cb(char *kabi_path, void *arg)
 	return WALK_CONT;
 }
 
+/* Compare all the files of the old pack, like walk_dir() does for a dir */
+static void compare_pack_files(compare_config_t *conf)
+{
+	size_t i;
+
+	for (i = 0; i < kabipack_count(conf->old_pack); i++) {
+		/* basename() may modify it and the pack is read-only */
+		char *filename = safe_strdup(kabipack_name(conf->old_pack, i));
+
+		if (!conf->skip_duplicate || !is_duplicate(filename)) {
+			free_files();
+			if (compare_two_files(filename, NULL, false))
+				conf->ret = EXIT_KABI_CHANGE;
+		}
+
+		free(filename);
+	}
+}
+
+static void compare_free_packs(void)
+{
+	if (compare_config.old_pack != NULL)
+		kabipack_free(compare_config.old_pack);
+	if (compare_config.new_pack != NULL)
+		kabipack_free(compare_config.new_pack);
+}
+
 #define COMPARE_NO_OPT(name) \
 	{"no-"#name, no_argument, &compare_config.no_##name, 1}
 
@@ -779,7 +836,13 @@ int compare(int argc, char **argv)
 	if ((stat(old_dir, &sb1) == -1) || (stat(new_dir, &sb2) == -1))
 		fail("stat failed: %s\n", strerror(errno));
 
-	if (S_ISREG(sb1.st_mode) && S_ISREG(sb2.st_mode)) {
+	if (S_ISREG(sb1.st_mode))
+		compare_config.old_pack = kabipack_open(old_dir);
+	if (S_ISREG(sb2.st_mode))
+		compare_config.new_pack = kabipack_open(new_dir);
+
+	if (S_ISREG(sb1.st_mode) && S_ISREG(sb2.st_mode) &&
+	    compare_config.old_pack == NULL && compare_config.new_pack == NULL) {
 		char *oldname = basename(old_dir);
 		char *newname = basename(new_dir);
 
@@ -793,15 +856,21 @@ int compare(int argc, char **argv)
 		return compare_two_files(oldname, newname, false);
 	}
 
-	if (!S_ISDIR(sb1.st_mode) || !S_ISDIR(sb2.st_mode)) {
-		printf("Compare takes two directories or two regular"
-		       " files as arguments\n");
+	if ((!S_ISDIR(sb1.st_mode) && compare_config.old_pack == NULL) ||
+	    (!S_ISDIR(sb2.st_mode) && compare_config.new_pack == NULL)) {
+		printf("Compare takes two directories or kABI packs, or two"
+		       " regular files as arguments\n");
 		compare_usage();
 	}
 
 	if (optind == argc) {
-		walk_dir(old_dir, false, compare_files_cb, &compare_config);
+		if (compare_config.old_pack != NULL)
+			compare_pack_files(&compare_config);
+		else
+			walk_dir(old_dir, false, compare_files_cb,
+				 &compare_config);
 
+		compare_free_packs();
 		return compare_config.ret;
 	}
 
@@ -811,15 +880,23 @@ int compare(int argc, char **argv)
 		filename = compare_config.filename =  argv[optind++];
 		safe_asprintf(&path, "%s/%s", old_dir, filename);
 
-		if (stat(path, &sb1) == -1) {
-			if (errno == ENOENT)
+		if (compare_config.old_pack != NULL) {
+			if (kabipack_find(compare_config.old_pack,
+					  filename) == -1)
 				fail("file does not exist: %s\n", path);
-			fail("stat failed: %s\n", strerror(errno));
-		}
+		} else {
+			if (stat(path, &sb1) == -1) {
+				if (errno == ENOENT)
+					fail("file does not exist: %s\n",
+					     path);
+				fail("stat failed: %s\n", strerror(errno));
+			}
 
-		if (!S_ISREG(sb1.st_mode)) {
-			printf("Compare third argument must be a regular file");
-			compare_usage();
+			if (!S_ISREG(sb1.st_mode)) {
+				printf("Compare third argument must be a"
+				       " regular file");
+				compare_usage();
+			}
 		}
 		free(path);
 
@@ -827,5 +904,6 @@ int compare(int argc, char **argv)
 			compare_config.ret = EXIT_KABI_CHANGE;
 	}
 
+	compare_free_packs();
 	return compare_config.ret;
 }
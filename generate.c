@@ -36,6 +36,7 @@
 #include <assert.h>
 #include <getopt.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include <elfutils/libdw.h>
 #include <elfutils/libdwfl.h>
@@ -50,6 +51,10 @@
 #include "objects.h"
 #include "list.h"
 #include "record.h"
+#include "threadpool.h"
+#include "cache.h"
+#include "kabipack.h"
+#include "nameindex.h"
 
 #define	EMPTY_NAME	"(NULL)"
 #define PROCESSED_SIZE 1024
@@ -68,8 +73,50 @@
 #define DW_AT_alignment 0x88
 #endif
 
-struct set;
-struct record_db;
+struct gen_job;
+struct cu_job;
+
+/*
+ * The db is shared with the generate workers only for the declaration
+ * dummies lookup, everything else is done by the thread folding the results.
+ */
+struct record_db {
+	struct hash *hash;
+	struct record_list **lists; /* Indexed by the ids of the keys */
+	unsigned int cnt;
+	unsigned int size;
+	pthread_mutex_t lock;
+};
+
+struct record_list {
+	const char *key; /* Interned */
+	struct record *decl_dummy;
+	/*
+	 * Records with the merged flag set are unavailable,
+	 * due to their data being moved.
+	 */
+	struct ilist records;
+	struct ilist postponed;
+	unsigned int id; /* Dense id of the key, given by the db */
+	size_t pos; /* Position in the db hash, used while merging */
+	uint64_t mark; /* Epoch of the last merge walk visiting the key */
+	/* The record found first by the merge session of the stamp */
+	struct record *accumulated;
+	uint64_t accumulated_stamp;
+};
+
+/*
+ * Per CU table of the objects by integer keys, open addressing table
+ * growing at 3/4 load. Slots without a value are free.
+ */
+struct cu_map {
+	struct cu_map_slot {
+		uint64_t key;
+		void *val;
+	} *slots;
+	unsigned int cnt;
+	unsigned int size; /* Power of two */
+};
 
 typedef struct {
 	char *kernel_dir; /* Path to  the kernel modules to process */
@@ -80,26 +127,51 @@ typedef struct {
 	bool rhel_tree;
 	bool verbose;
 	bool gen_extra;
+	unsigned int jobs; /* Number of threads to use */
+	unsigned int cu_jobs; /* Number of CUs of a module processed in parallel */
+	char *cache_dir; /* Where to keep the generated records per module */
+	char *tool_stamp; /* Identifies the build of kabi-dw in the cache */
+	bool cancel; /* All the requested symbols were found */
 } generate_config_t;
 
 struct cu_ctx {
 	generate_config_t *conf;
 	Dwarf_Die *cu_die;
 	stack_t *stack; /* Current stack of symbol we're parsing */
-	struct set *processed; /* Set of processed types for this CU */
+	struct cu_map processed; /* Records of the processed types by key id */
+	struct cu_map inline_types; /* Types without records by DIE offset */
+	struct cu_map keys; /* Record lists of the types by DIE offset */
+	struct cu_map files; /* Normalized paths by file index */
 	unsigned char dw_version : 6;
 	unsigned char elf_endian : 2;
 	struct ksymtab *ksymtab; /* ksymtab of the current kernel module */
 	struct hash *cu_db;
+	struct arena arena; /* Objects not owned by any record */
 };
 
 struct file_ctx {
 	generate_config_t *conf;
+	struct gen_job *job;
+	struct cu_job *cu; /* Set when the CUs are processed in parallel */
 	struct ksymtab *ksymtab; /* ksymtab of the current kernel module */
+	struct cu_filter *cu_filter; /* NULL if all the CUs are processed */
 	unsigned char dw_version : 6;
 	unsigned char elf_endian : 2;
 };
 
+/*
+ * Sorted offsets of the CUs which define exported symbols. If the filter
+ * comes from a name index, the CUs the index doesn't cover are kept too.
+ */
+struct cu_filter {
+	Dwarf_Off *offs;
+	size_t cnt;
+	size_t alloc;
+	Dwarf_Off *indexed; /* NULL if all the CUs are covered */
+	size_t indexed_cnt;
+	size_t indexed_alloc;
+};
+
 struct dwarf_type {
 	unsigned int dwarf_tag;
 	char *prefix;
@@ -125,19 +197,192 @@ static void obj_fill_ns(obj_t *obj, struct cu_ctx *ctx, const char *name)
 static void record_redirect_dependents(struct record *rec_dst,
 				       struct record *rec_src)
 {
-	struct list_node *iter;
+	struct ilist *iter;
 
-	LIST_FOR_EACH(&rec_src->dependents, iter) {
-		obj_t *obj = list_node_data(iter);
+	ILIST_FOR_EACH(&rec_src->dependents, iter) {
+		obj_t *obj = ilist_entry(iter, obj_t, depend_link);
 
 		obj->ref_record = rec_dst;
 	}
 }
 
-static const bool is_builtin(Dwarf_Die *die)
+/*
+ * The attributes of a DIE kabi-dw looks at. They are read in a single
+ * dwarf_getattrs() pass instead of rescanning the attribute list of the
+ * DIE for every dwarf_hasattr() and dwarf_attr().
+ */
+enum die_attr_idx {
+	DIE_ATTR_NAME,
+	DIE_ATTR_TYPE,
+	DIE_ATTR_BYTE_SIZE,
+	DIE_ATTR_BIT_SIZE,
+	DIE_ATTR_BIT_OFFSET,
+	DIE_ATTR_DATA_BIT_OFFSET,
+	DIE_ATTR_DATA_MEMBER_LOCATION,
+	DIE_ATTR_ALIGNMENT,
+	DIE_ATTR_CONST_VALUE,
+	DIE_ATTR_UPPER_BOUND,
+	DIE_ATTR_COUNT,
+	DIE_ATTR_ENDIANITY,
+	DIE_ATTR_DECLARATION,
+	DIE_ATTR_EXTERNAL,
+	DIE_ATTR_DECL_FILE,
+	DIE_ATTR_DECL_LINE,
+	DIE_ATTR_SPECIFICATION,
+	DIE_ATTR_ABSTRACT_ORIGIN,
+	DIE_ATTR_NR
+};
+
+struct die_attrs {
+	Dwarf_Die *die;
+	unsigned int tag;
+	unsigned int present; /* Bitmask of enum die_attr_idx */
+	Dwarf_Attribute attr[DIE_ATTR_NR];
+};
+
+static int die_attrs_cb(Dwarf_Attribute *attr, void *arg)
+{
+	struct die_attrs *attrs = arg;
+	enum die_attr_idx idx;
+
+	switch (dwarf_whatattr(attr)) {
+	case DW_AT_name:
+		idx = DIE_ATTR_NAME;
+		break;
+	case DW_AT_type:
+		idx = DIE_ATTR_TYPE;
+		break;
+	case DW_AT_byte_size:
+		idx = DIE_ATTR_BYTE_SIZE;
+		break;
+	case DW_AT_bit_size:
+		idx = DIE_ATTR_BIT_SIZE;
+		break;
+	case DW_AT_bit_offset:
+		idx = DIE_ATTR_BIT_OFFSET;
+		break;
+	case DW_AT_data_bit_offset:
+		idx = DIE_ATTR_DATA_BIT_OFFSET;
+		break;
+	case DW_AT_data_member_location:
+		idx = DIE_ATTR_DATA_MEMBER_LOCATION;
+		break;
+	case DW_AT_alignment:
+		idx = DIE_ATTR_ALIGNMENT;
+		break;
+	case DW_AT_const_value:
+		idx = DIE_ATTR_CONST_VALUE;
+		break;
+	case DW_AT_upper_bound:
+		idx = DIE_ATTR_UPPER_BOUND;
+		break;
+	case DW_AT_count:
+		idx = DIE_ATTR_COUNT;
+		break;
+	case DW_AT_endianity:
+		idx = DIE_ATTR_ENDIANITY;
+		break;
+	case DW_AT_declaration:
+		idx = DIE_ATTR_DECLARATION;
+		break;
+	case DW_AT_external:
+		idx = DIE_ATTR_EXTERNAL;
+		break;
+	case DW_AT_decl_file:
+		idx = DIE_ATTR_DECL_FILE;
+		break;
+	case DW_AT_decl_line:
+		idx = DIE_ATTR_DECL_LINE;
+		break;
+	case DW_AT_specification:
+		idx = DIE_ATTR_SPECIFICATION;
+		break;
+	case DW_AT_abstract_origin:
+		idx = DIE_ATTR_ABSTRACT_ORIGIN;
+		break;
+	default:
+		return DWARF_CB_OK;
+	}
+
+	attrs->attr[idx] = *attr;
+	attrs->present |= 1u << idx;
+
+	return DWARF_CB_OK;
+}
+
+static void die_attrs_read(Dwarf_Die *die, struct die_attrs *attrs)
+{
+	attrs->die = die;
+	attrs->tag = dwarf_tag(die);
+	attrs->present = 0;
+
+	if (dwarf_getattrs(die, die_attrs_cb, attrs, 0) == -1)
+		fail("dwarf_getattrs() failed for %s\n", dwarf_diename(die));
+}
+
+static inline bool die_attrs_has(struct die_attrs *attrs,
+				 enum die_attr_idx idx)
+{
+	return attrs->present & (1u << idx);
+}
+
+/* Same as dwarf_diename(), including the name of the origin DIE */
+static const char *die_attrs_name(struct die_attrs *attrs)
+{
+	if (die_attrs_has(attrs, DIE_ATTR_NAME))
+		return dwarf_formstring(&attrs->attr[DIE_ATTR_NAME]);
+	if (die_attrs_has(attrs, DIE_ATTR_SPECIFICATION) ||
+	    die_attrs_has(attrs, DIE_ATTR_ABSTRACT_ORIGIN))
+		return dwarf_diename(attrs->die);
+	return NULL;
+}
+
+static bool die_attrs_flag(struct die_attrs *attrs, enum die_attr_idx idx)
+{
+	Dwarf_Attribute *attr = &attrs->attr[idx];
+
+	if (!die_attrs_has(attrs, idx))
+		return false;
+	if (dwarf_hasform(attr, DW_FORM_flag))
+		return attr->valp != NULL;
+	if (!dwarf_hasform(attr, DW_FORM_flag_present))
+		return false;
+	return true;
+}
+
+/* Same as dwarf_decl_file(), including the file of the origin DIE */
+static const char *die_attrs_decl_file(struct die_attrs *attrs)
+{
+	Dwarf_Die cu_die;
+	Dwarf_Files *files;
+	Dwarf_Word idx;
+	size_t nfiles;
+
+	if (!die_attrs_has(attrs, DIE_ATTR_DECL_FILE)) {
+		if (die_attrs_has(attrs, DIE_ATTR_SPECIFICATION) ||
+		    die_attrs_has(attrs, DIE_ATTR_ABSTRACT_ORIGIN))
+			return dwarf_decl_file(attrs->die);
+		return NULL;
+	}
+
+	if (dwarf_formudata(&attrs->attr[DIE_ATTR_DECL_FILE], &idx) != 0)
+		return NULL;
+	/* Zero means no source file information available */
+	if (idx == 0)
+		return NULL;
+	if (dwarf_diecu(attrs->die, &cu_die, NULL, NULL) == NULL)
+		return NULL;
+	if (dwarf_getsrcfiles(&cu_die, &files, &nfiles) != 0)
+		return NULL;
+	if (idx >= nfiles)
+		return NULL;
+
+	return dwarf_filesrc(files, idx, NULL, NULL);
+}
+
+static const bool is_builtin(const char *path)
 {
 	char *fname;
-	const char *path = dwarf_decl_file(die);
 
 	if (path == NULL)
 		return true;
@@ -150,10 +395,10 @@ static const bool is_builtin(Dwarf_Die *die)
 	return false;
 }
 
-static const char *get_die_name(Dwarf_Die *die)
+static const char *get_die_name(struct die_attrs *attrs)
 {
-	if (dwarf_hasattr(die, DW_AT_name))
-		return dwarf_diename(die);
+	if (die_attrs_has(attrs, DIE_ATTR_NAME))
+		return dwarf_formstring(&attrs->attr[DIE_ATTR_NAME]);
 	else
 		return EMPTY_NAME;
 }
@@ -162,29 +407,17 @@ static const char *get_die_name(Dwarf_Die *die)
  * Check if given DIE has DW_AT_declaration attribute.
  * That indicates that the symbol is just a declaration, not full definition.
  */
-static bool is_declaration(Dwarf_Die *die)
+static bool is_declaration(struct die_attrs *attrs)
 {
-	Dwarf_Attribute attr;
-
-	if (!dwarf_hasattr(die, DW_AT_declaration))
-		return false;
-	(void) dwarf_attr(die, DW_AT_declaration, &attr);
-	if (dwarf_hasform(&attr, DW_FORM_flag))
-		return attr.valp != NULL;
-	if (!dwarf_hasform(&attr, DW_FORM_flag_present))
-		return false;
-	return true;
+	return die_attrs_flag(attrs, DIE_ATTR_DECLARATION);
 }
 
 static char *get_file_replace_path;
 
-static char *_get_file(Dwarf_Die *cu_die, Dwarf_Die *die)
+static const char *_get_file(const char *filename)
 {
-	const char *filename;
 	char *ret;
 
-	filename = dwarf_decl_file(die);
-
 	if (get_file_replace_path) {
 		int len = strlen(get_file_replace_path);
 
@@ -199,57 +432,64 @@ static char *_get_file(Dwarf_Die *cu_die, Dwarf_Die *die)
 	ret = safe_strdup(filename);
 	path_normalize(ret);
 
-	return ret;
+	return global_string_get_move(ret);
 }
 
-static char *get_file(Dwarf_Die *cu_die, Dwarf_Die *die)
+static const char *get_file(struct die_attrs *attrs)
 {
-	Dwarf_Attribute attr;
+	const char *path = die_attrs_decl_file(attrs);
+	struct die_attrs spec_attrs;
 	Dwarf_Die spec_die;
 
 	/*
 	 * Handle types built-in in C compiler. These are for example the
 	 * variable argument list which is defined as * struct __va_list_tag.
 	 */
-	if (is_builtin(die))
-		return safe_strdup(BUILTIN_PATH);
+	if (is_builtin(path))
+		return BUILTIN_PATH;
 
-	if (dwarf_hasattr(die, DW_AT_decl_file))
-		return _get_file(cu_die, die);
+	if (die_attrs_has(attrs, DIE_ATTR_DECL_FILE))
+		return _get_file(path);
 
-	if ((dwarf_attr(die, DW_AT_specification, &attr) == NULL) ||
-	    (dwarf_formref_die(&attr, &spec_die) == NULL)) {
+	if (!die_attrs_has(attrs, DIE_ATTR_SPECIFICATION) ||
+	    dwarf_formref_die(&attrs->attr[DIE_ATTR_SPECIFICATION],
+			      &spec_die) == NULL) {
 		fail("DIE missing file information: %s\n",
-		     dwarf_diename(die));
+		     dwarf_diename(attrs->die));
 	}
 
-	return _get_file(cu_die, &spec_die);
+	die_attrs_read(&spec_die, &spec_attrs);
+	return _get_file(die_attrs_decl_file(&spec_attrs));
 }
 
-static long get_line(Dwarf_Die *cu_die, Dwarf_Die *die)
+static long get_line(struct die_attrs *attrs)
 {
-	Dwarf_Attribute attr;
+	struct die_attrs spec_attrs;
 	Dwarf_Word line;
 	Dwarf_Die spec_die;
 
-	if (is_builtin(die))
+	if (is_builtin(die_attrs_decl_file(attrs)))
 		return 0;
 
-	if (dwarf_attr(die, DW_AT_decl_line, &attr) != NULL) {
-		dwarf_formudata(&attr, &line);
+	if (die_attrs_has(attrs, DIE_ATTR_DECL_LINE)) {
+		dwarf_formudata(&attrs->attr[DIE_ATTR_DECL_LINE], &line);
 		return line;
 	}
 
-	if ((dwarf_attr(die, DW_AT_specification, &attr) == NULL) ||
-	    (dwarf_formref_die(&attr, &spec_die) == NULL)) {
+	if (!die_attrs_has(attrs, DIE_ATTR_SPECIFICATION) ||
+	    dwarf_formref_die(&attrs->attr[DIE_ATTR_SPECIFICATION],
+			      &spec_die) == NULL) {
 		fail("DIE missing line information: %s\n",
-		     dwarf_diename(die));
+		     dwarf_diename(attrs->die));
 	}
 
-	return get_line(cu_die, &spec_die);
+	die_attrs_read(&spec_die, &spec_attrs);
+	return get_line(&spec_attrs);
 }
 
 static obj_t *print_die(struct cu_ctx *, struct record *, Dwarf_Die *);
+static obj_t *_print_die(struct cu_ctx *, struct record *,
+			 struct die_attrs *);
 
 static const char *dwarf_tag_string(unsigned int tag)
 {
@@ -274,10 +514,10 @@ static char *get_file_prefix(unsigned int dwarf_tag)
 	return current->prefix;
 }
 
-static char *get_symbol_file(Dwarf_Die *die, Dwarf_Die *cu_die)
+static char *get_symbol_file(struct die_attrs *attrs)
 {
-	const char *name = dwarf_diename(die);
-	unsigned int tag = dwarf_tag(die);
+	const char *name = die_attrs_name(attrs);
+	unsigned int tag = attrs->tag;
 	char *file_prefix;
 	char *file_name = NULL;
 
@@ -317,27 +557,24 @@ static char *get_symbol_file(Dwarf_Die *die, Dwarf_Die *cu_die)
  * or in case of reference to the specification,
  * the specification DIE can be exported.
  */
-static int is_external(Dwarf_Die *die)
+static int is_external(struct die_attrs *attrs)
 {
-	Dwarf_Attribute attr;
+	struct die_attrs spec_attrs;
 	Dwarf_Die spec_die;
 
-	if (dwarf_hasattr(die, DW_AT_external)) {
-		dwarf_attr(die, DW_AT_external, &attr);
-		if (dwarf_hasform(&attr, DW_FORM_flag))
-			return attr.valp != NULL;
-		if (!dwarf_hasform(&attr, DW_FORM_flag_present))
-			return false;
-		return true;
-	}
+	if (die_attrs_has(attrs, DIE_ATTR_EXTERNAL))
+		return die_attrs_flag(attrs, DIE_ATTR_EXTERNAL);
 
-	if (dwarf_attr(die, DW_AT_specification, &attr) == NULL)
+	if (!die_attrs_has(attrs, DIE_ATTR_SPECIFICATION))
 		return false;
 
-	if (dwarf_formref_die(&attr, &spec_die) == NULL)
+	if (dwarf_formref_die(&attrs->attr[DIE_ATTR_SPECIFICATION],
+			      &spec_die) == NULL)
 		fail("dwarf_formref_die() failed for %s\n",
-		     dwarf_diename(die));
-	return is_external(&spec_die);
+		     dwarf_diename(attrs->die));
+
+	die_attrs_read(&spec_die, &spec_attrs);
+	return is_external(&spec_attrs);
 }
 
 static uint8_t die_attr_eval_op(Dwarf_Attribute *attr, Dwarf_Word *value)
@@ -425,19 +662,17 @@ static uint8_t die_attr_eval_op(Dwarf_Attribute *attr, Dwarf_Word *value)
 	return loc_expr_type;
 }
 
-static Dwarf_Word die_get_attr(Dwarf_Die *die, Dwarf_Half ar_attr)
+static Dwarf_Word die_get_attr(struct die_attrs *attrs,
+			       enum die_attr_idx idx)
 {
 	int attr_form;
 	Dwarf_Word value = 0;
-	Dwarf_Attribute attr;
-
-	if (!dwarf_hasattr(die, ar_attr))
-		return value;
+	Dwarf_Attribute *attr = &attrs->attr[idx];
 
-	if (dwarf_attr(die, ar_attr, &attr) == NULL)
+	if (!die_attrs_has(attrs, idx))
 		return value;
 
-	attr_form = dwarf_whatform(&attr);
+	attr_form = dwarf_whatform(attr);
 
 	switch (attr_form) {
 	case DW_FORM_data1:
@@ -456,26 +691,28 @@ static Dwarf_Word die_get_attr(Dwarf_Die *die, Dwarf_Half ar_attr)
 	case DW_FORM_addrx2:
 	case DW_FORM_addrx3:
 	case DW_FORM_addrx4:
-		if (dwarf_formudata(&attr, &value) == -1)
+		if (dwarf_formudata(attr, &value) == -1)
 			fail("Unable to get DWARF data for %s:0x%x:0x%x\n",
-			     dwarf_diename(die), attr_form, ar_attr);
+			     dwarf_diename(attrs->die), attr_form,
+			     dwarf_whatattr(attr));
 		break;
 	case DW_FORM_block:
 	case DW_FORM_block1:
 	case DW_FORM_block2:
 	case DW_FORM_block4:
-		die_attr_eval_op(&attr, &value);
+		die_attr_eval_op(attr, &value);
 		break;
 	default:
 		fail("Unsupported DWARF form 0x%x for DIE %s, type 0x%x\n",
-		     attr_form, dwarf_diename(die), ar_attr);
+		     attr_form, dwarf_diename(attrs->die),
+		     dwarf_whatattr(attr));
 		break;
 	}
 
 	return value;
 }
 
-static unsigned int die_get_byte_size(Dwarf_Die *die, obj_t *obj)
+static unsigned int die_get_byte_size(struct die_attrs *attrs, obj_t *obj)
 {
 	unsigned int byte_sz_1;
 	unsigned int byte_sz_2;
@@ -495,8 +732,8 @@ static unsigned int die_get_byte_size(Dwarf_Die *die, obj_t *obj)
 	 * specified in DWARF for any given DIE, we need to check both to
 	 * get byte size.
 	 */
-	byte_sz_1 = die_get_attr(die, DW_AT_byte_size);
-	byte_sz_2 = die_get_attr(die, DW_AT_bit_size);
+	byte_sz_1 = die_get_attr(attrs, DIE_ATTR_BYTE_SIZE);
+	byte_sz_2 = die_get_attr(attrs, DIE_ATTR_BIT_SIZE);
 
 	assert(byte_sz_2 % CHAR_BIT == 0);
 
@@ -504,7 +741,7 @@ static unsigned int die_get_byte_size(Dwarf_Die *die, obj_t *obj)
 
 	if (byte_sz_1 > 0 && byte_sz_2 > 0 && byte_sz_1 != byte_sz_2)
 		fail("DIE %s: DW_AT_byte_size and DW_AT_bit_size differ\n",
-		     dwarf_diename(die));
+		     dwarf_diename(attrs->die));
 
 	if (byte_sz_1 > 0)
 		return byte_sz_1;
@@ -512,16 +749,16 @@ static unsigned int die_get_byte_size(Dwarf_Die *die, obj_t *obj)
 	return byte_sz_2;
 }
 
-static obj_t *die_read_byte_size(Dwarf_Die *die, obj_t *obj)
+static obj_t *die_read_byte_size(struct die_attrs *attrs, obj_t *obj)
 {
 	obj_t *ptr = obj;
 	unsigned int coeff = 1;
 	unsigned int byte_size = 0;
 
 	while (ptr != NULL) {
-		byte_size = die_get_byte_size(die, ptr);
+		byte_size = die_get_byte_size(attrs, ptr);
 
-		if (ptr->index && dwarf_tag(die) == DW_TAG_array_type)
+		if (ptr->index && attrs->tag == DW_TAG_array_type)
 			coeff *= ptr->index;
 
 		if (byte_size > 0) {
@@ -535,65 +772,74 @@ static obj_t *die_read_byte_size(Dwarf_Die *die, obj_t *obj)
 	return obj;
 }
 
-static obj_t *die_read_alignment(Dwarf_Die *die, obj_t *obj)
+static obj_t *die_read_alignment(struct die_attrs *attrs, obj_t *obj)
 {
-	obj->alignment = die_get_attr(die, DW_AT_alignment);
+	obj->alignment = die_get_attr(attrs, DIE_ATTR_ALIGNMENT);
 	return obj;
 }
 
-struct set *set_init(size_t size)
+static inline unsigned int cu_map_slot(struct cu_map *map, uint64_t key)
 {
-	struct hash *h;
-
-	h = hash_new(size, free);
-	if (h == NULL)
-		fail("Cannot create hash");
-
-	return (struct set *)h;
+	/* Fibonacci hashing, the keys are mostly dense */
+	return (key * 11400714819323198485ull) >> 32 & (map->size - 1);
 }
 
-static void set_add(struct set *set, const char *key)
+static void *cu_map_find(struct cu_map *map, uint64_t key)
 {
-	char *storage;
-	struct hash *h = (struct hash *)set;
+	unsigned int i;
 
-	storage = safe_strdup(key);
-	hash_add(h, storage, storage);
-}
+	if (map->size == 0)
+		return NULL;
 
-static bool set_contains(struct set *set, const char *key)
-{
-	void *v;
-	struct hash *h = (struct hash *)set;
+	for (i = cu_map_slot(map, key);
+	     map->slots[i].val != NULL;
+	     i = (i + 1) & (map->size - 1)) {
+		if (map->slots[i].key == key)
+			return map->slots[i].val;
+	}
 
-	v = hash_find(h, key);
-	return v != NULL;
+	return NULL;
 }
 
-static void set_free(struct set *set)
+static void cu_map_insert(struct cu_map *map, uint64_t key, void *val)
 {
-	struct hash *h = (struct hash *)set;
+	unsigned int i = cu_map_slot(map, key);
+
+	while (map->slots[i].val != NULL)
+		i = (i + 1) & (map->size - 1);
 
-	hash_free(h);
+	map->slots[i].key = key;
+	map->slots[i].val = val;
+	map->cnt++;
 }
 
-bool record_same_declarations(struct record *r1, struct record *r2,
-			      struct set *processed)
+static void cu_map_add(struct cu_map *map, uint64_t key, void *val)
 {
-	if (r1 == r2)
-		return true;
-
-	if (record_is_declaration(r1) || record_is_declaration(r2))
-		/* since they are not same, only one is a declaration */
-		return false;
-
-	if (set_contains(processed, r1->key))
-		/* skipping already processed record */
-		return true;
+	if ((map->cnt + 1) * 4 > map->size * 3) {
+		struct cu_map_slot *old = map->slots;
+		unsigned int old_size = map->size;
+		unsigned int i;
+
+		map->size = old_size ? old_size * 2 : PROCESSED_SIZE;
+		map->slots = safe_zmalloc(map->size * sizeof(*map->slots));
+		map->cnt = 0;
+
+		for (i = 0; i < old_size; i++) {
+			if (old[i].val != NULL)
+				cu_map_insert(map, old[i].key, old[i].val);
+		}
+		free(old);
+	}
 
-	set_add(processed, r1->key);
+	cu_map_insert(map, key, val);
+}
 
-	return obj_same_declarations(r1->obj, r2->obj, processed);
+static void cu_map_free(struct cu_map *map)
+{
+	free(map->slots);
+	map->slots = NULL;
+	map->cnt = 0;
+	map->size = 0;
 }
 
 static struct record *record_alloc(void)
@@ -601,13 +847,15 @@ static struct record *record_alloc(void)
 	struct record *rec;
 
 	rec = safe_zmalloc(sizeof(*rec));
+	ilist_init(&rec->dependents);
 	return rec;
 }
 
 static void record_free_regular(struct record *rec)
 {
 	void *data;
-	struct list_node *iter;
+	struct ilist *iter;
+	struct ilist *tmp;
 
 	if (rec->cu)
 		free(rec->cu);
@@ -616,14 +864,11 @@ static void record_free_regular(struct record *rec)
 		free(data);
 	stack_destroy(rec->stack);
 
-	LIST_FOR_EACH(&rec->dependents, iter) {
-		obj_t *o = list_node_data(iter);
-
-		o->depend_rec_node = NULL;
-	}
-	list_clear(&rec->dependents);
+	ILIST_FOR_EACH_SAFE(&rec->dependents, iter, tmp)
+		ilist_del(iter);
 
-	obj_free(rec->obj);
+	obj_detach(rec->obj);
+	arena_free(&rec->arena);
 }
 
 static void record_free_weak(struct record *rec)
@@ -638,7 +883,7 @@ static void record_free(struct record *rec)
 	free(rec);
 }
 
-static void record_put(struct record *rec)
+void record_put(struct record *rec)
 {
 	assert(rec->ref_count > 0);
 
@@ -651,25 +896,21 @@ static void record_get(struct record *rec)
 	rec->ref_count++;
 }
 
-static void record_dump_regular(struct record *rec, FILE *f);
-
-static struct record *record_new_regular(const char *key)
+struct record *record_new_regular(const char *key)
 {
 	struct record *rec;
 
 	rec = record_alloc();
 	rec->key = global_string_get_copy(key);
 	rec->stack = stack_init();
+	arena_init(&rec->arena, OBJ_ARENA_CHUNK_SIZE);
 	rec->free = record_free_regular;
 	rec->dump = record_dump_regular;
-	list_init(&rec->dependents, NULL);
 	record_get(rec);
 	return rec;
 }
 
-static void record_dump_assembly(struct record *rec, FILE *f);
-
-static struct record *record_new_assembly(const char *key)
+struct record *record_new_assembly(const char *key)
 {
 	struct record *rec;
 
@@ -690,9 +931,7 @@ static struct record *record_new_assembly(const char *key)
 	return rec;
 }
 
-static void record_dump_weak(struct record *rec, FILE *f);
-
-static struct record *record_new_weak(const char *key, const char *link)
+struct record *record_new_weak(const char *key, const char *link)
 {
 	struct record *rec;
 
@@ -717,26 +956,37 @@ static struct record *record_copy(struct record *src)
 {
 	struct record *res = record_new_regular("");
 	obj_t *o1 = record_obj(src);
+	struct arena *prev;
 
-	res->obj = obj_merge(o1, o1, MERGE_FLAG_DECL_MERGE);
+	prev = obj_arena_set(&res->arena);
+	res->obj = obj_clone(o1);
+	obj_arena_set(prev);
 	obj_fill_parent(res->obj);
 	res->origin = src->origin;
 
 	return res;
 }
 
-static obj_t *record_obj_exchange(struct record *rec, obj_t *o)
+static const char *record_origin(struct record *rec)
 {
-	obj_t *old;
-
-	old = rec->obj;
-	rec->obj = o;
-	return old;
+	return rec->origin;
 }
 
-static const char *record_origin(struct record *rec)
+/*
+ * Structural hash of the record, cached until its object changes.
+ * Used to group the records which are likely to merge.
+ */
+static uint64_t record_get_digest(struct record *rec)
 {
-	return rec->origin;
+	const char *origin = rec->origin ? rec->origin : "";
+
+	if (!rec->has_digest) {
+		rec->digest = fnv1a_64(obj_hash(rec->obj), origin,
+				       strlen(origin));
+		rec->has_digest = true;
+	}
+
+	return rec->digest;
 }
 
 static void copy_stack_cb(void *data, void *arg)
@@ -765,26 +1015,49 @@ static void record_add_cu(struct record *rec, Dwarf_Die *cu_die)
 	safe_asprintf(&rec->cu, "CU: \"%s\"\n", name);
 }
 
-static void record_add_origin(struct record *rec,
-			      Dwarf_Die *cu_die,
-			      Dwarf_Die *die)
+/*
+ * The paths of the DIEs of the current CU are cached by their file index,
+ * a CU has only a few hundred distinct files.
+ */
+static const char *get_file_cached(struct cu_ctx *ctx,
+				   struct die_attrs *attrs)
+{
+	Dwarf_Word idx;
+	const char *path;
+
+	if (!die_attrs_has(attrs, DIE_ATTR_DECL_FILE) ||
+	    attrs->die->cu != ctx->cu_die->cu ||
+	    dwarf_formudata(&attrs->attr[DIE_ATTR_DECL_FILE], &idx) != 0)
+		return get_file(attrs);
+
+	path = cu_map_find(&ctx->files, idx);
+	if (path == NULL) {
+		path = get_file(attrs);
+		cu_map_add(&ctx->files, idx, (void *)path);
+	}
+
+	return path;
+}
+
+static void record_add_origin(struct cu_ctx *ctx,
+			      struct record *rec,
+			      struct die_attrs *attrs)
 {
-	char *dec_file;
+	const char *dec_file;
 	long dec_line;
 	char *origin;
 
-	dec_file = get_file(cu_die, die);
-	dec_line = get_line(cu_die, die);
+	dec_file = get_file_cached(ctx, attrs);
+	dec_line = get_line(attrs);
 
 	safe_asprintf(&origin, "File: %s:%lu\n", dec_file, dec_line);
 	rec->origin = global_string_get_move(origin);
-
-	free(dec_file);
 }
 
 static struct record *record_start(struct cu_ctx *ctx,
-				   Dwarf_Die *die,
-				   char *key)
+				   struct die_attrs *attrs,
+				   struct record_list *rec_list,
+				   const char *key)
 {
 	struct record *rec = NULL;
 	generate_config_t *conf = ctx->conf;
@@ -800,12 +1073,14 @@ static struct record *record_start(struct cu_ctx *ctx,
 	 * of its full tree, thus the difference in speed is many orders
 	 * of magnitude!
 	 */
-	if (set_contains(ctx->processed, key))
+	if (cu_map_find(&ctx->processed, rec_list->id) != NULL)
 		goto done;
 
-	set_add(ctx->processed, key);
-
-	if (is_declaration(die)) {
+	/*
+	 * A declaration doesn't make the type processed, the CU can
+	 * contain its definition as well.
+	 */
+	if (is_declaration(attrs)) {
 		if (conf->verbose)
 			printf("WARNING: Skipping following file as we "
 			       "have only declaration: %s\n", key);
@@ -816,10 +1091,12 @@ static struct record *record_start(struct cu_ctx *ctx,
 		printf("Generating %s\n", key);
 
 	rec = record_new_regular(key);
+	rec->rec_list = rec_list;
+	cu_map_add(&ctx->processed, rec_list->id, rec);
 
 	if (conf->gen_extra)
 		record_add_cu(rec, cu_die);
-	record_add_origin(rec, cu_die, die);
+	record_add_origin(ctx, rec, attrs);
 	record_add_stack(rec, ctx->stack);
 done:
 	return rec;
@@ -830,8 +1107,24 @@ static void record_set_version(struct record *rec, int version)
 	rec->version = version;
 }
 
-static void record_close(struct record *rec, obj_t *obj)
+/*
+ * Share the immutable subtrees of the record and move the rest to a new
+ * arena, so the replaced nodes don't stay around with the record.
+ */
+void record_close(struct record *rec, obj_t *obj)
 {
+	struct arena arena;
+	struct arena *prev;
+
+	obj = obj_share(obj);
+
+	arena_init(&arena, OBJ_ARENA_CHUNK_SIZE);
+	prev = obj_arena_set(&arena);
+	obj = obj_move(obj);
+	obj_arena_set(prev);
+	arena_free(&rec->arena);
+	rec->arena = arena;
+
 	obj_fill_parent(obj);
 	rec->obj = obj;
 }
@@ -850,7 +1143,7 @@ static void record_stack_dump_and_clear(struct record *rec, FILE *f)
 	} while ((data = stack_pop(rec->stack)) != NULL);
 }
 
-static void record_dump_regular(struct record *rec, FILE *f)
+void record_dump_regular(struct record *rec, FILE *f)
 {
 	int rc;
 
@@ -877,7 +1170,7 @@ static void record_dump_regular(struct record *rec, FILE *f)
 	obj_dump(rec->obj, f);
 }
 
-static void record_dump_assembly(struct record *rec, FILE *f)
+void record_dump_assembly(struct record *rec, FILE *f)
 {
 	char *name = filenametosymbol(rec->key);
 	int rc;
@@ -888,7 +1181,7 @@ static void record_dump_assembly(struct record *rec, FILE *f)
 		fail("Could not put assembly\n");
 }
 
-static void record_dump_weak(struct record *rec, FILE *f)
+void record_dump_weak(struct record *rec, FILE *f)
 {
 	char *name = filenametosymbol(rec->key);
 	int rc;
@@ -929,6 +1222,33 @@ static void record_dump(struct record *rec, const char *dir)
 	fclose(f);
 }
 
+static void record_dump_pack(struct record *rec, struct kabipack_writer *pack)
+{
+	char *name;
+	char *data;
+	size_t size;
+	FILE *f;
+
+	if (rec->version == 0)
+		safe_asprintf(&name, "%s.txt", rec->key);
+	else
+		safe_asprintf(&name, "%s-%i.txt", rec->key, rec->version);
+
+	f = open_memstream(&data, &size);
+	if (f == NULL)
+		fail("open_memstream() failed: %m\n");
+
+	rec->dump(rec, f);
+
+	if (fclose(f) != 0)
+		fail("Cannot dump record '%s': %m\n", name);
+
+	kabipack_add(pack, name, data, size);
+
+	free(data);
+	free(name);
+}
+
 static void list_record_free(void *value)
 {
 	struct record *rec = value;
@@ -936,6 +1256,19 @@ static void list_record_free(void *value)
 	record_put(rec);
 }
 
+/*
+ * Check if rec_src can be merged to the record rec_dst
+ */
+static bool record_can_merge(struct record *rec_dst,
+			     struct record *rec_src,
+			     unsigned int flags)
+{
+	if (record_origin(rec_dst) != record_origin(rec_src))
+		return false;
+
+	return obj_can_merge(record_obj(rec_dst), record_obj(rec_src), flags);
+}
+
 /*
  * merge rec_src to the record rec_dst
  */
@@ -943,42 +1276,17 @@ static bool record_merge(struct record *rec_dst,
 			 struct record *rec_src,
 			 unsigned int flags)
 {
-	const char *s1;
-	const char *s2;
-	obj_t *o1;
-	obj_t *o2;
-	obj_t *o;
-
-	s1 = record_origin(rec_dst);
-	s2 = record_origin(rec_src);
-
-	if (s1 != s2)
-		return false;
-
-	o1 = record_obj(rec_dst);
-	o2 = record_obj(rec_src);
-
-	o = obj_merge(o1, o2, flags);
-	if (o == NULL)
+	if (!record_can_merge(rec_dst, rec_src, flags))
 		return false;
 
-	obj_fill_parent(o);
-	o = record_obj_exchange(rec_dst, o);
-	obj_free(o);
+	if (obj_merge_changes(record_obj(rec_dst), record_obj(rec_src))) {
+		obj_merge(record_obj(rec_dst), record_obj(rec_src));
+		rec_dst->has_digest = false;
+	}
 
 	return true;
 }
 
-struct record_list {
-	struct record *decl_dummy;
-	/*
-	 * Nodes with data members set to NULL are unavailable,
-	 * due to their data being moved.
-	 */
-	struct list *records;
-	struct list *postponed;
-};
-
 static struct record_list *record_list_new(const char *key)
 {
 	struct record_list *rec_list = safe_zmalloc(sizeof(*rec_list));
@@ -989,35 +1297,56 @@ static struct record_list *record_list_new(const char *key)
 	rec_list->decl_dummy->version = RECORD_VERSION_DECLARATION;
 	free(declaration_key);
 
-	rec_list->records = list_new(list_record_free);
-	rec_list->postponed = list_new(NULL);
+	ilist_init(&rec_list->records);
+	ilist_init(&rec_list->postponed);
 
 	return rec_list;
 }
 
+static inline struct record *record_entry(struct ilist *link)
+{
+	return ilist_entry(link, struct record, list_node);
+}
+
+/* Remove the record from its list, dropping the reference of the list */
+static void record_release(struct record *rec)
+{
+	ilist_del(&rec->list_node);
+	record_put(rec);
+}
+
 static void record_list_free(struct record_list *rec_list)
 {
-	assert(list_len(rec_list->postponed) == 0);
+	struct ilist *iter;
+	struct ilist *tmp;
+
+	assert(ilist_empty(&rec_list->postponed));
 
 	record_free(rec_list->decl_dummy);
-	list_free(rec_list->records);
-	list_free(rec_list->postponed);
+	ILIST_FOR_EACH_SAFE(&rec_list->records, iter, tmp)
+		record_release(record_entry(iter));
 	free(rec_list);
 }
 
-static inline void record_list_node_make_unavailable(struct list_node *node)
+/*
+ * The merged record stays in its list, so the lists being walked while
+ * merging are not changed under the walkers. It gets released once the
+ * list is cleaned up.
+ */
+static inline void record_make_unavailable(struct record *rec)
 {
-	node->data = NULL;
+	assert(ilist_linked(&rec->list_node));
+	rec->merged = true;
 }
 
-static inline bool record_list_node_is_available(struct list_node *node)
+static inline bool record_is_available(struct record *rec)
 {
-	return node->data != NULL;
+	return !rec->merged;
 }
 
-static inline struct list *record_list_records(struct record_list *rec_list)
+static inline struct ilist *record_list_records(struct record_list *rec_list)
 {
-	return rec_list->records;
+	return &rec_list->records;
 }
 
 static inline struct record *record_list_decl_dummy(struct record_list *rec_list)
@@ -1027,44 +1356,138 @@ static inline struct record *record_list_decl_dummy(struct record_list *rec_list
 
 static void record_list_restore_postponed(struct record_list *rec_list)
 {
-	list_concat(rec_list->records, rec_list->postponed);
+	ilist_splice_tail(&rec_list->records, &rec_list->postponed);
+}
+
+static uint64_t merge_epoch;
+
+/* Every merge walk gets its own epoch to mark the keys it visits with */
+static uint64_t merge_epoch_next(void)
+{
+	return __atomic_add_fetch(&merge_epoch, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Mark the key of the record as visited by the walk of the epoch.
+ * Returns false if the walk has visited it already.
+ */
+static bool record_key_visit(struct record *rec, uint64_t epoch)
+{
+	struct record_list *rec_list = rec->rec_list;
+
+	assert(rec_list != NULL);
+
+	if (rec_list->mark == epoch)
+		return false;
+
+	rec_list->mark = epoch;
+	return true;
+}
+
+bool record_same_declarations(struct record *r1, struct record *r2,
+			      uint64_t epoch)
+{
+	if (r1 == r2)
+		return true;
+
+	if (record_is_declaration(r1) || record_is_declaration(r2))
+		/* since they are not same, only one is a declaration */
+		return false;
+
+	if (!record_key_visit(r1, epoch))
+		/* skipping already processed record */
+		return true;
+
+	return obj_same_declarations(r1->obj, r2->obj, epoch);
 }
 
 static struct record_list *record_db_lookup_or_init(struct record_db *db,
 					       const char *key)
 {
 	struct record_list *rec_list;
-	struct hash *hash = (struct hash *)db;
 
-	rec_list = hash_find(hash, key);
+	pthread_mutex_lock(&db->lock);
+
+	rec_list = hash_find(db->hash, key);
 	if (rec_list == NULL) {
 		rec_list = record_list_new(key);
+		rec_list->key = global_string_get_copy(key);
+
+		if (db->cnt == db->size) {
+			db->size = db->size ? db->size * 2 : DB_SIZE;
+			db->lists = safe_realloc(db->lists,
+						 db->size * sizeof(*db->lists));
+		}
+		rec_list->id = db->cnt;
+		db->lists[db->cnt++] = rec_list;
 
-		hash_add(hash, global_string_get_copy(key), rec_list);
+		hash_add(db->hash, rec_list->key, rec_list);
 	}
 
+	pthread_mutex_unlock(&db->lock);
+
 	return rec_list;
 }
 
 struct merging_ctx {
 	/*
-	 * records found since recursion entry;
+	 * epoch marking the keys found since recursion entry;
 	 * used for infinite loop detection
 	 */
-	struct set *current_records;
+	uint64_t epoch;
 	/*
-	 * records found since manual reset;
-	 * newly found records are merged with records in the hash
+	 * stamp of the records found since manual reset, kept by their
+	 * record lists; newly found records are merged with those
 	 */
-	struct hash *accumulated_records;
+	uint64_t stamp;
 
 
 	unsigned int flags;
 
-	bool use_copies; /* use copies of records instead of actual record */
+	/* only check if the records can be merged, without merging them */
+	bool dry_run;
+	/* copies of the records the dry run had to modify */
+	struct ilist copies;
 	bool merged;
 };
 
+static struct record *record_accumulated(struct merging_ctx *ctx,
+					 struct record_list *rec_list)
+{
+	if (rec_list->accumulated_stamp != ctx->stamp)
+		return NULL;
+
+	return rec_list->accumulated;
+}
+
+static void record_accumulate(struct merging_ctx *ctx,
+			      struct record_list *rec_list,
+			      struct record *rec)
+{
+	rec_list->accumulated = rec;
+	rec_list->accumulated_stamp = ctx->stamp;
+}
+
+/*
+ * The dry run keeps the records it finds first, and only copies them
+ * once a merge would modify them.
+ */
+static struct record *record_merge_dry_copy(struct merging_ctx *ctx,
+					    struct record *rec)
+{
+	struct record *copy;
+
+	/* only the copies are not in the db */
+	if (rec->rec_list == NULL)
+		return rec;
+
+	copy = record_copy(rec);
+	ilist_add_tail(&ctx->copies, &copy->list_node);
+	record_accumulate(ctx, rec->rec_list, copy);
+
+	return copy;
+}
+
 static int record_merge_walk_record(struct record *followed,
 				    struct merging_ctx *ctx);
 static int record_merge_walk_object(obj_t *obj, void *arg)
@@ -1079,49 +1502,49 @@ static int record_merge_walk_record(struct record *followed,
 				    struct merging_ctx *ctx)
 {
 	struct record *record_dst;
-	bool clean_up = false;
 
 	if (record_is_declaration(followed))
 		return CB_CONT;
 
-	if (set_contains(ctx->current_records, followed->key))
+	if (!record_key_visit(followed, ctx->epoch))
 		return CB_CONT;
-	set_add(ctx->current_records, followed->key);
 
-	record_dst = hash_find(ctx->accumulated_records, followed->key);
+	record_dst = record_accumulated(ctx, followed->rec_list);
 
 	if (record_dst == NULL) {
 		/* first of this key found */
-		if (ctx->use_copies)
-			record_dst = record_copy(followed);
-		else
-			record_dst = followed;
-		hash_add(ctx->accumulated_records, followed->key, record_dst);
+		record_accumulate(ctx, followed->rec_list, followed);
 	} else {
 		if (record_dst == followed)
 			return CB_CONT;
 
-		if (!record_merge(record_dst, followed, ctx->flags))
-			return CB_FAIL;
+		if (ctx->dry_run) {
+			if (!record_can_merge(record_dst, followed, ctx->flags))
+				return CB_FAIL;
+
+			if (obj_merge_changes(record_obj(record_dst),
+					      record_obj(followed))) {
+				record_dst = record_merge_dry_copy(ctx,
+								   record_dst);
+				obj_merge(record_obj(record_dst),
+					  record_obj(followed));
+				record_dst->has_digest = false;
+			}
+		} else {
+			if (!record_merge(record_dst, followed, ctx->flags))
+				return CB_FAIL;
 
-		ctx->merged = true;
-		if (!ctx->use_copies) {
 			record_redirect_dependents(record_dst, followed);
-			list_concat(&record_dst->dependents,
-				    &followed->dependents);
+			ilist_splice_tail(&record_dst->dependents,
+					  &followed->dependents);
 
-			record_list_node_make_unavailable(followed->list_node);
-			clean_up = true;
+			record_make_unavailable(followed);
 		}
-	}
-
-	int status = obj_walk_tree(followed->obj,
-				   record_merge_walk_object, ctx);
 
-	if (clean_up)
-		record_put(followed);
+		ctx->merged = true;
+	}
 
-	return status;
+	return obj_walk_tree(followed->obj, record_merge_walk_object, ctx);
 }
 
 static int record_merge_walk(struct record *starting_rec,
@@ -1129,57 +1552,54 @@ static int record_merge_walk(struct record *starting_rec,
 {
 	int result;
 
-	ctx->current_records = set_init(PROCESSED_SIZE);
+	ctx->epoch = merge_epoch_next();
 	result = record_merge_walk_record(starting_rec, ctx);
-	set_free(ctx->current_records);
 
 	return result != CB_FAIL;
 }
 
-static bool record_merge_many_sub(struct list *list,
-				  unsigned int flags, bool use_copies)
+static bool record_merge_many_sub(struct record **records, size_t cnt,
+				  unsigned int flags, bool dry_run)
 {
-	void (*free_fun)(void *);
 	struct merging_ctx ctx;
-	struct list_node *iter;
+	struct ilist *iter;
+	struct ilist *tmp;
 	bool result = false;
-
-	if (use_copies)
-		free_fun = (void (*)(void *))record_free;
-	else
-		free_fun = NULL;
+	size_t i;
 
 	ctx.flags = flags;
-	ctx.current_records = NULL;
+	ctx.epoch = 0;
 	ctx.merged = false;
 
-	/* first, check if the list can be merged into one record */
-	ctx.use_copies = use_copies;
-	ctx.accumulated_records = hash_new(PROCESSED_SIZE, free_fun);
+	ctx.dry_run = dry_run;
+	ilist_init(&ctx.copies);
+	ctx.stamp = merge_epoch_next();
 
-	LIST_FOR_EACH(list, iter) {
-		result = record_merge_walk(list_node_data(iter), &ctx);
+	for (i = 0; i < cnt; i++) {
+		result = record_merge_walk(records[i], &ctx);
 
-		if (result == false && use_copies)
+		if (result == false && dry_run)
 			break;
 	}
-	hash_free(ctx.accumulated_records);
+	ILIST_FOR_EACH_SAFE(&ctx.copies, iter, tmp)
+		record_release(record_entry(iter));
 
 	return result && ctx.merged;
 }
 
-static bool record_merge_many(struct list *list, unsigned int flags)
+static bool record_merge_many(struct record **records, size_t cnt,
+			      unsigned int flags)
 {
 	bool result;
 
-	/* first, check if the list can be merged into one record */
-	result = record_merge_many_sub(list, flags, true);
+	/* first, check if the records can be merged into one record */
+	result = record_merge_many_sub(records, cnt, flags, true);
 
 	if (result == false)
 		return false;
 
-	/* if it can be, then merge it */
-	result = record_merge_many_sub(list, flags, false);
+	/* if they can be, then merge them */
+	result = record_merge_many_sub(records, cnt, flags, false);
 
 	return result;
 }
@@ -1187,22 +1607,18 @@ static bool record_merge_many(struct list *list, unsigned int flags)
 static void record_list_clean_up(struct record_list *rec_list)
 {
 	const unsigned int FAILED_LIMIT = 10;
-	struct list_node *next = rec_list->records->first;
+	struct ilist *iter;
+	struct ilist *tmp;
 
-	while (next != NULL) {
-		struct list_node *temp;
-		struct record *rec;
+	ILIST_FOR_EACH_SAFE(&rec_list->records, iter, tmp) {
+		struct record *rec = record_entry(iter);
 
-		temp = next;
-		rec = list_node_data(temp);
-		next = next->next;
-
-		if (!rec) {
+		if (!record_is_available(rec)) {
 			/* record was merged */
-			list_del(temp);
+			record_release(rec);
 		} else if (rec->failed > FAILED_LIMIT) {
-			list_del(temp);
-			rec->list_node = list_add(rec_list->postponed, rec);
+			ilist_del(iter);
+			ilist_add_tail(&rec_list->postponed, iter);
 		}
 	}
 }
@@ -1211,28 +1627,21 @@ static bool record_merge_pair(struct record *record_dst,
 			      struct record *record_src)
 {
 	bool merged;
-	struct set *processed;
-	struct list to_merge;
+	struct record *to_merge[] = { record_dst, record_src };
 
-	if (record_dst == NULL)
+	if (!record_is_available(record_dst))
 		return false;
 
-	processed = set_init(PROCESSED_SIZE);
-	merged = record_same_declarations(record_dst, record_src, processed);
-	set_free(processed);
+	merged = record_same_declarations(record_dst, record_src,
+					  merge_epoch_next());
 	if (!merged) {
 		record_dst->failed++;
 		return false;
 	}
 
-	list_init(&to_merge, NULL);
-	list_add(&to_merge, record_dst);
-	list_add(&to_merge, record_src);
-
-	merged = record_merge_many(&to_merge,
+	merged = record_merge_many(to_merge, 2,
 				    MERGE_FLAG_VER_IGNORE |
 				    MERGE_FLAG_DECL_EQ);
-	list_clear(&to_merge);
 
 	if (merged) {
 		/* continue with next unmerged */
@@ -1241,7 +1650,6 @@ static bool record_merge_pair(struct record *record_dst,
 	}
 
 	record_dst->failed++;
-	list_clear(&to_merge);
 
 	return false;
 }
@@ -1272,78 +1680,279 @@ static char *record_db_add(struct record_db *db, struct record *rec)
 
 	struct record *tmp_rec;
 	struct record_list *rec_list;
-	struct list_node *iter;
+	struct ilist *iter;
 	int records_amount;
 
 	rec_list = record_db_lookup_or_init(db, rec->key);
 
-	LIST_FOR_EACH(record_list_records(rec_list), iter) {
-		tmp_rec = list_node_data(iter);
+	ILIST_FOR_EACH(record_list_records(rec_list), iter) {
+		tmp_rec = record_entry(iter);
+
+		if (!record_is_available(tmp_rec))
+			continue;
 
 		if (record_merge(tmp_rec, rec, MERGE_DEFAULT)) {
 			record_redirect_dependents(tmp_rec, rec);
-			list_concat(&tmp_rec->dependents, &rec->dependents);
+			ilist_splice_tail(&tmp_rec->dependents,
+					  &rec->dependents);
 			return safe_strdup(tmp_rec->key);
 		}
 	}
 
-	records_amount = list_len(record_list_records(rec_list));
+	records_amount = ilist_len(record_list_records(rec_list));
 
 	record_get(rec);
 	record_set_version(rec, records_amount);
 	record_redirect_dependents(rec, rec);
-	rec->list_node = list_add(record_list_records(rec_list), rec);
+	rec->rec_list = rec_list;
+	ilist_add_tail(record_list_records(rec_list), &rec->list_node);
 
 	return safe_strdup(rec->key);
 }
 
+/*
+ * The records of a CU with the references between them. The outcome of
+ * merging a record only depends on the records it reaches, so a failed
+ * merge is only retried once one of those has been merged.
+ */
+struct cu_merge_node {
+	struct record *rec;
+	struct cu_merge_node **refs;
+	size_t refs_cnt;
+	size_t refs_size;
+	struct cu_merge_node **referrers;
+	size_t referrers_cnt;
+	size_t referrers_size;
+	unsigned int mark;
+	bool dirty;
+};
+
+struct cu_merge_graph {
+	struct cu_merge_node *nodes;
+	size_t cnt;
+	struct hash *index;
+	struct cu_merge_node **queue;
+	unsigned int mark;
+};
+
+struct cu_merge_graph_ctx {
+	struct cu_merge_graph *graph;
+	struct cu_merge_node *node;
+};
+
+static void cu_merge_node_add(struct cu_merge_node ***array, size_t *cnt,
+			      size_t *size, struct cu_merge_node *node)
+{
+	if (*cnt == *size) {
+		*size = *size ? *size * 2 : 4;
+		*array = safe_realloc(*array, *size * sizeof(**array));
+	}
+	(*array)[(*cnt)++] = node;
+}
+
+static int cu_merge_graph_add_cb(obj_t *o, void *arg)
+{
+	struct cu_merge_graph_ctx *ctx = arg;
+	struct cu_merge_node *node = ctx->node;
+	struct cu_merge_node *ref;
+
+	if (o->type != __type_reffile || o->ref_record == NULL)
+		return CB_CONT;
+
+	/* Only the records of the CU can be merged, the rest never changes */
+	ref = hash_find(ctx->graph->index, o->ref_record->key);
+	if (ref == NULL || ref->rec != o->ref_record)
+		return CB_CONT;
+
+	cu_merge_node_add(&node->refs, &node->refs_cnt, &node->refs_size, ref);
+	cu_merge_node_add(&ref->referrers, &ref->referrers_cnt,
+			  &ref->referrers_size, node);
+
+	return CB_CONT;
+}
+
+static void cu_merge_graph_init(struct cu_merge_graph *graph,
+				struct ilist *records)
+{
+	struct cu_merge_graph_ctx ctx;
+	struct ilist *iter;
+	size_t i = 0;
+
+	graph->cnt = ilist_len(records);
+	graph->nodes = safe_zmalloc((graph->cnt + 1) * sizeof(*graph->nodes));
+	graph->queue = safe_zmalloc((graph->cnt + 1) * sizeof(*graph->queue));
+	graph->index = hash_new(graph->cnt, NULL);
+	graph->mark = 0;
+
+	ILIST_FOR_EACH(records, iter) {
+		struct cu_merge_node *node = &graph->nodes[i++];
+
+		node->rec = record_entry(iter);
+		node->dirty = true;
+		hash_add(graph->index, node->rec->key, node);
+	}
+
+	ctx.graph = graph;
+	for (i = 0; i < graph->cnt; i++) {
+		ctx.node = &graph->nodes[i];
+		obj_walk_tree(ctx.node->rec->obj, cu_merge_graph_add_cb, &ctx);
+	}
+}
+
+static void cu_merge_graph_free(struct cu_merge_graph *graph)
+{
+	size_t i;
+
+	for (i = 0; i < graph->cnt; i++) {
+		free(graph->nodes[i].refs);
+		free(graph->nodes[i].referrers);
+	}
+	free(graph->nodes);
+	free(graph->queue);
+	hash_free(graph->index);
+}
+
+/*
+ * The record of the node was merged with everything it reaches. Any record
+ * reaching one of those has to be tried again.
+ */
+static void cu_merge_graph_merged(struct cu_merge_graph *graph,
+				  struct cu_merge_node *node)
+{
+	struct cu_merge_node **queue = graph->queue;
+	unsigned int reached = ++graph->mark;
+	unsigned int reaching = ++graph->mark;
+	size_t head;
+	size_t tail = 0;
+	size_t i;
+
+	node->mark = reached;
+	queue[tail++] = node;
+	for (head = 0; head < tail; head++) {
+		for (i = 0; i < queue[head]->refs_cnt; i++) {
+			struct cu_merge_node *ref = queue[head]->refs[i];
+
+			if (ref->mark != reached) {
+				ref->mark = reached;
+				queue[tail++] = ref;
+			}
+		}
+	}
+
+	for (head = 0; head < tail; head++)
+		queue[head]->mark = reaching;
+
+	for (head = 0; head < tail; head++) {
+		queue[head]->dirty = true;
+
+		for (i = 0; i < queue[head]->referrers_cnt; i++) {
+			struct cu_merge_node *ref = queue[head]->referrers[i];
+
+			if (ref->mark != reaching) {
+				ref->mark = reaching;
+				queue[tail++] = ref;
+			}
+		}
+	}
+}
+
+/* Account for the merge of a record failing with all the records */
+static void record_list_merge_failed(struct record_list *rec_list)
+{
+	struct ilist *iter;
+
+	ILIST_FOR_EACH(record_list_records(rec_list), iter) {
+		struct record *rec = record_entry(iter);
+
+		if (record_is_available(rec))
+			rec->failed++;
+	}
+}
+
+static int record_key_cmp(const void *a, const void *b)
+{
+	const struct record *r1 = *(const struct record **)a;
+	const struct record *r2 = *(const struct record **)b;
+
+	return strcmp(r1->key, r2->key);
+}
+
+/*
+ * The records of the CU are merged in the order of their keys, so the
+ * versions they get don't depend on the layout of the hash.
+ */
 static void record_db_add_cu(struct record_db *db, struct hash *cu_db)
 {
-	struct list unmerged_list;
+	struct ilist unmerged_list;
+	struct cu_merge_graph graph;
 	struct hash_iter iter;
 	const void *val;
 	bool merged;
-	struct list_node *unmerged_iter;
-	struct list_node *merger_iter;
+	struct ilist *unmerged_iter;
+	struct ilist *merger_iter;
+	struct ilist *tmp;
+	struct record **recs;
+	size_t cnt = hash_get_count(cu_db);
+	size_t i = 0;
+
+	recs = safe_zmalloc((cnt + 1) * sizeof(*recs));
+	hash_iter_init((struct hash *)cu_db, &iter);
+	while (hash_iter_next(&iter, NULL, &val))
+		recs[i++] = (struct record *)val;
+	qsort(recs, cnt, sizeof(*recs), record_key_cmp);
 
 	/*
 	 * Use list instead of hash map,
 	 * since nodes are going to be gradually removed.
 	 */
-	list_init(&unmerged_list, NULL);
-	hash_iter_init((struct hash *)cu_db, &iter);
-	while (hash_iter_next(&iter, NULL, &val)) {
-		struct record *rec = (struct record *)val;
-
-		rec->list_node = list_add(&unmerged_list, rec);
+	ilist_init(&unmerged_list);
+	for (i = 0; i < cnt; i++) {
+		struct record *rec = recs[i];
+
+		/* Only the records read from the cache don't have it yet */
+		if (rec->rec_list == NULL)
+			rec->rec_list = record_db_lookup_or_init(db, rec->key);
+		ilist_add_tail(&unmerged_list, &rec->list_node);
 	}
+	free(recs);
+
+	cu_merge_graph_init(&graph, &unmerged_list);
 
 	/* try to merge, as long as at least one record was merged */
 	do {
 		merged = false;
+		i = 0;
 
-		LIST_FOR_EACH(&unmerged_list, unmerged_iter) {
+		ILIST_FOR_EACH(&unmerged_list, unmerged_iter) {
+			struct cu_merge_node *node = &graph.nodes[i++];
 			struct record *unmerged_record
-				= list_node_data(unmerged_iter);
+				= record_entry(unmerged_iter);
 			struct record_list *rec_list;
-			struct list *records;
-			const char *key;
+			struct ilist *records;
 
-			if (!record_list_node_is_available(unmerged_iter)) {
+			if (!record_is_available(unmerged_record)) {
 				/* already merged */
 				continue;
 			}
 
-			key = unmerged_record->key;
-			rec_list = record_db_lookup_or_init(db, key);
+			rec_list = unmerged_record->rec_list;
 			records = record_list_records(rec_list);
 
-			LIST_FOR_EACH(records, merger_iter) {
+			if (!node->dirty) {
+				/* nothing it reaches changed since it failed */
+				record_list_merge_failed(rec_list);
+				record_list_clean_up(rec_list);
+				continue;
+			}
+			node->dirty = false;
+
+			ILIST_FOR_EACH(records, merger_iter) {
 				struct record *merger
-					= list_node_data(merger_iter);
+					= record_entry(merger_iter);
 
 				if (record_merge_pair(merger,
 						      unmerged_record)) {
+					cu_merge_graph_merged(&graph, node);
 					merged = true;
 					break;
 				}
@@ -1353,120 +1962,127 @@ static void record_db_add_cu(struct record_db *db, struct hash *cu_db)
 		}
 	} while (merged);
 
+	cu_merge_graph_free(&graph);
+
 	/* add the rest that was not merged */
-	LIST_FOR_EACH(&unmerged_list, unmerged_iter) {
-		struct record *unmerged_record = list_node_data(unmerged_iter);
+	ILIST_FOR_EACH_SAFE(&unmerged_list, unmerged_iter, tmp) {
+		struct record *unmerged_record = record_entry(unmerged_iter);
 		struct record_list *rec_list;
-		struct list *records;
+		struct ilist *records;
 
-		if (!record_list_node_is_available(unmerged_iter)) {
+		if (!record_is_available(unmerged_record)) {
 			/* already merged */
+			record_release(unmerged_record);
 			continue;
 		}
 
-		rec_list = record_db_lookup_or_init(db, unmerged_record->key);
+		rec_list = unmerged_record->rec_list;
 		records = record_list_records(rec_list);
 
-		unmerged_record->list_node
-			= list_add(records, unmerged_record);
+		ilist_del(unmerged_iter);
+		ilist_add_tail(records, unmerged_iter);
 	}
-	list_clear(&unmerged_list);
-}
-
-static void hash_list_free(void *value)
-{
-	struct record_list *rec_list = value;
-
-	record_list_free(rec_list);
 }
 
 static struct record_db *record_db_init(void)
 {
-	struct hash *db;
+	struct record_db *db = safe_zmalloc(sizeof(*db));
 
-	db = hash_new(DB_SIZE, hash_list_free);
-	if (db == NULL)
+	db->hash = hash_new(DB_SIZE, NULL);
+	if (db->hash == NULL)
 		fail("Could not create db (hash)\n");
+	pthread_mutex_init(&db->lock, NULL);
 
-	return (struct record_db *)db;
+	return db;
 }
 
-static void record_db_dump(struct record_db *_db, char *dir)
+static void record_db_dump(struct record_db *db, char *dir)
 {
-	struct hash_iter iter;
-	const void *v;
-	struct hash *db = (struct hash *)_db;
+	struct kabipack_writer *pack = NULL;
+	unsigned int i;
+
+	if (safe_strendswith(dir, KABIPACK_SUFFIX))
+		pack = kabipack_create(dir);
 
 	/* set correct versions */
-	hash_iter_init(db, &iter);
-	while (hash_iter_next(&iter, NULL, &v)) {
-		struct list_node *iter;
-		struct record_list *rec_list = (struct record_list *)v;
+	for (i = 0; i < db->cnt; i++) {
+		struct ilist *iter;
+		struct record_list *rec_list = db->lists[i];
 		int ver = 0;
 
-		LIST_FOR_EACH(record_list_records(rec_list), iter) {
-			struct record *record = list_node_data(iter);
+		ILIST_FOR_EACH(record_list_records(rec_list), iter) {
+			struct record *record = record_entry(iter);
 
 			record_set_version(record, ver++);
 		}
 	}
 
-	hash_iter_init(db, &iter);
-	while (hash_iter_next(&iter, NULL, &v)) {
-		struct record_list *rec_list = (struct record_list *)v;
-		struct list_node *iter;
+	for (i = 0; i < db->cnt; i++) {
+		struct record_list *rec_list = db->lists[i];
+		struct ilist *iter;
 
-		LIST_FOR_EACH(record_list_records(rec_list), iter) {
-			struct record *rec = list_node_data(iter);
+		ILIST_FOR_EACH(record_list_records(rec_list), iter) {
+			struct record *rec = record_entry(iter);
 
-			record_dump(rec, dir);
+			if (pack != NULL)
+				record_dump_pack(rec, pack);
+			else
+				record_dump(rec, dir);
 		}
 	}
+
+	if (pack != NULL)
+		kabipack_close(pack);
 }
 
-static void record_db_free(struct record_db *_db)
+static void record_db_free(struct record_db *db)
 {
-	struct hash *db = (struct hash *)_db;
-
-	hash_free(db);
+	unsigned int i;
+
+	for (i = 0; i < db->cnt; i++)
+		record_list_free(db->lists[i]);
+	free(db->lists);
+	hash_free(db->hash);
+	pthread_mutex_destroy(&db->lock);
+	free(db);
 }
 
 static obj_t *print_die_type(struct cu_ctx *ctx,
 			     struct record *rec,
-			     Dwarf_Die *die)
+			     struct die_attrs *attrs)
 {
+	struct die_attrs type_attrs;
 	Dwarf_Die type_die;
-	Dwarf_Attribute attr;
 
-	if (!dwarf_hasattr(die, DW_AT_type))
+	if (!die_attrs_has(attrs, DIE_ATTR_TYPE))
 		return obj_basetype_new(safe_strdup("void"));
 
-	(void) dwarf_attr(die, DW_AT_type, &attr);
-	if (dwarf_formref_die(&attr, &type_die) == NULL)
+	if (dwarf_formref_die(&attrs->attr[DIE_ATTR_TYPE], &type_die) == NULL)
 		fail("dwarf_formref_die() failed for %s\n",
-		    dwarf_diename(die));
+		    dwarf_diename(attrs->die));
 
-	if (dwarf_hasattr(&type_die, DW_AT_endianity))
+	die_attrs_read(&type_die, &type_attrs);
+	if (die_attrs_has(&type_attrs, DIE_ATTR_ENDIANITY))
 		fail("DIE %s has non-standard endianity\n",
 		     dwarf_diename(&type_die))
 
 	/* Print the type of the die */
-	return print_die(ctx, rec, &type_die);
+	return _print_die(ctx, rec, &type_attrs);
 }
 
 static obj_t *print_die_struct_member(struct cu_ctx *ctx,
 				      struct record *rec,
-				      Dwarf_Die *die,
+				      struct die_attrs *attrs,
 				      const char *name)
 {
 	obj_t *type;
 	obj_t *obj;
-	Dwarf_Half dw_attr_bit_offset;
+	enum die_attr_idx dw_attr_bit_offset;
 	unsigned int bit_offset = 0;
 
-	type = print_die_type(ctx, rec, die);
+	type = print_die_type(ctx, rec, attrs);
 	obj = obj_struct_member_new_add(safe_strdup(name), type);
-	die_read_alignment(die, obj);
+	die_read_alignment(attrs, obj);
 
 	/*
 	 * DWARF attribute specifying offset varies depending on DWARF version.
@@ -1474,10 +2090,12 @@ static obj_t *print_die_struct_member(struct cu_ctx *ctx,
 	 * back attribute DW_AT_data_bit_offset (present in DWARF v4 and later)
 	 * is used when not encountered.
 	 */
-	if (dwarf_hasattr(die, DW_AT_data_member_location))
-		obj->offset = die_get_attr(die, DW_AT_data_member_location);
-	else if (dwarf_hasattr(die, DW_AT_data_bit_offset))
-		obj->offset = die_get_attr(die, DW_AT_data_bit_offset)/CHAR_BIT;
+	if (die_attrs_has(attrs, DIE_ATTR_DATA_MEMBER_LOCATION))
+		obj->offset = die_get_attr(attrs,
+					   DIE_ATTR_DATA_MEMBER_LOCATION);
+	else if (die_attrs_has(attrs, DIE_ATTR_DATA_BIT_OFFSET))
+		obj->offset = die_get_attr(attrs,
+					   DIE_ATTR_DATA_BIT_OFFSET)/CHAR_BIT;
 
 	/*
 	 * DWARF attribute specifying bit-offset. Note that DW_AT_bit_offset
@@ -1485,10 +2103,10 @@ static obj_t *print_die_struct_member(struct cu_ctx *ctx,
 	 * Presence of this attribute indicates that we're dealing with
 	 * bit-field.
 	 */
-	if (dwarf_hasattr(die, DW_AT_bit_offset))
-		dw_attr_bit_offset = DW_AT_bit_offset;
-	else if (dwarf_hasattr(die, DW_AT_data_bit_offset))
-		dw_attr_bit_offset = DW_AT_data_bit_offset;
+	if (die_attrs_has(attrs, DIE_ATTR_BIT_OFFSET))
+		dw_attr_bit_offset = DIE_ATTR_BIT_OFFSET;
+	else if (die_attrs_has(attrs, DIE_ATTR_DATA_BIT_OFFSET))
+		dw_attr_bit_offset = DIE_ATTR_DATA_BIT_OFFSET;
 	else
 		goto out;
 
@@ -1498,21 +2116,23 @@ static obj_t *print_die_struct_member(struct cu_ctx *ctx,
 	 */
 	obj->is_bitfield = 1;
 
-	if (dwarf_hasattr(die, DW_AT_data_bit_offset)) {
-		bit_offset = die_get_attr(die, dw_attr_bit_offset);
+	if (die_attrs_has(attrs, DIE_ATTR_DATA_BIT_OFFSET)) {
+		bit_offset = die_get_attr(attrs, dw_attr_bit_offset);
 	} else if (ctx->elf_endian == ELFDATA2MSB) {
-		bit_offset = die_get_attr(die, dw_attr_bit_offset) \
+		bit_offset = die_get_attr(attrs, dw_attr_bit_offset) \
 			   + obj->offset*CHAR_BIT;
 	} else {
-		bit_offset = die_get_attr(die, DW_AT_byte_size) * CHAR_BIT \
+		bit_offset = die_get_attr(attrs, DIE_ATTR_BYTE_SIZE) \
+			   * CHAR_BIT \
 			   + obj->offset * CHAR_BIT \
-			   - die_get_attr(die, DW_AT_bit_offset) \
-			   - die_get_attr(die, DW_AT_bit_size);
+			   - die_get_attr(attrs, DIE_ATTR_BIT_OFFSET) \
+			   - die_get_attr(attrs, DIE_ATTR_BIT_SIZE);
 	}
 
 	obj->offset = bit_offset / CHAR_BIT;
 	obj->first_bit = bit_offset % CHAR_BIT;
-	obj->last_bit  = die_get_attr(die, DW_AT_bit_size) + obj->first_bit;
+	obj->last_bit  = die_get_attr(attrs, DIE_ATTR_BIT_SIZE) \
+			 + obj->first_bit;
 
 out:
 	return obj;
@@ -1520,35 +2140,31 @@ out:
 
 static obj_t *print_die_structure(struct cu_ctx *ctx,
 				  struct record *rec,
-				  Dwarf_Die *die)
+				  struct die_attrs *attrs)
 {
-	const char *name = get_die_name(die);
-	unsigned int tag;
-	obj_list_head_t *members = NULL;
+	const char *name = get_die_name(attrs);
+	obj_list_t *members = NULL;
 	obj_t *obj;
 	obj_t *member;
+	struct die_attrs child_attrs;
 	Dwarf_Die child_die;
 
 	obj = obj_struct_new(safe_strdup(name));
 
-	if (!dwarf_haschildren(die))
+	if (!dwarf_haschildren(attrs->die))
 		goto done;
 
-	dwarf_child(die, &child_die);
+	dwarf_child(attrs->die, &child_die);
 	do {
-		Dwarf_Die *die = &child_die;
+		die_attrs_read(&child_die, &child_attrs);
 
-		name = get_die_name(die);
-		tag = dwarf_tag(die);
-		if (tag != DW_TAG_member)
+		name = get_die_name(&child_attrs);
+		if (child_attrs.tag != DW_TAG_member)
 			fail("Unexpected tag for structure type children: "
-			    "%s\n", dwarf_tag_string(tag));
+			    "%s\n", dwarf_tag_string(child_attrs.tag));
 
-		member = print_die_struct_member(ctx, rec, die, name);
-		if (members == NULL)
-			members = obj_list_head_new(member);
-		else
-			obj_list_add(members, member);
+		member = print_die_struct_member(ctx, rec, &child_attrs, name);
+		members = obj_list_add(members, member);
 
 	} while (dwarf_siblingof(&child_die, &child_die) == 0);
 
@@ -1559,17 +2175,16 @@ done:
 
 static obj_t *print_die_enumerator(struct cu_ctx *ctx,
 				   struct record *rec,
-				   Dwarf_Die *die,
+				   struct die_attrs *attrs,
 				   const char *name)
 {
-	Dwarf_Attribute attr;
 	Dwarf_Word value;
 	obj_t *obj;
 
-	if (dwarf_attr(die, DW_AT_const_value, &attr) == NULL)
+	if (!die_attrs_has(attrs, DIE_ATTR_CONST_VALUE))
 		fail("Value of enumerator %s missing!\n", name);
 
-	(void) dwarf_formudata(&attr, &value);
+	(void) dwarf_formudata(&attrs->attr[DIE_ATTR_CONST_VALUE], &value);
 
 	obj = obj_constant_new(safe_strdup(name));
 	obj->constant = value;
@@ -1579,31 +2194,28 @@ static obj_t *print_die_enumerator(struct cu_ctx *ctx,
 
 static obj_t *print_die_enumeration(struct cu_ctx *ctx,
 				    struct record *rec,
-				    Dwarf_Die *die) {
-	const char *name = get_die_name(die);
-	obj_list_head_t *members = NULL;
+				    struct die_attrs *attrs) {
+	const char *name = get_die_name(attrs);
+	obj_list_t *members = NULL;
 	obj_t *member;
 	obj_t *obj;
+	struct die_attrs child_attrs;
 	Dwarf_Die child_die;
 
 	obj = obj_enum_new(safe_strdup(name));
 
-	if (!dwarf_haschildren(die))
+	if (!dwarf_haschildren(attrs->die))
 		goto done;
 
-	dwarf_child(die, &child_die);
+	dwarf_child(attrs->die, &child_die);
 	do {
-		Dwarf_Die *die = &child_die;
+		die_attrs_read(&child_die, &child_attrs);
 
-		name = get_die_name(die);
-		member = print_die_enumerator(ctx, rec, die, name);
-		if (members == NULL)
-			members = obj_list_head_new(member);
-		else
-			obj_list_add(members, member);
+		name = get_die_name(&child_attrs);
+		member = print_die_enumerator(ctx, rec, &child_attrs, name);
+		members = obj_list_add(members, member);
 	} while (dwarf_siblingof(&child_die, &child_die) == 0);
 
-	members->object = obj;
 	obj->member_list = members;
 done:
 	return obj;
@@ -1611,78 +2223,74 @@ done:
 
 static obj_t *print_die_union(struct cu_ctx *ctx,
 			      struct record *rec,
-			      Dwarf_Die *die)
+			      struct die_attrs *attrs)
 {
-	const char *name = get_die_name(die);
-	unsigned int tag;
-	obj_list_head_t *members = NULL;
+	const char *name = get_die_name(attrs);
+	obj_list_t *members = NULL;
 	obj_t *member;
 	obj_t *type;
 	obj_t *obj;
+	struct die_attrs child_attrs;
 	Dwarf_Die child_die;
 
 	obj = obj_union_new(safe_strdup(name));
 
-	if (!dwarf_haschildren(die))
+	if (!dwarf_haschildren(attrs->die))
 		goto done;
 
-	dwarf_child(die, &child_die);
+	dwarf_child(attrs->die, &child_die);
 	do {
-		Dwarf_Die *die = &child_die;
+		die_attrs_read(&child_die, &child_attrs);
 
-		name = get_die_name(die);
-		tag = dwarf_tag(die);
-		if (tag != DW_TAG_member)
+		name = get_die_name(&child_attrs);
+		if (child_attrs.tag != DW_TAG_member)
 			fail("Unexpected tag for union type children: %s\n",
-			    dwarf_tag_string(tag));
+			    dwarf_tag_string(child_attrs.tag));
 
-		type = print_die_type(ctx, rec, die);
+		type = print_die_type(ctx, rec, &child_attrs);
 		member = obj_var_new_add(safe_strdup(name), type);
 
-		if (members == NULL)
-			members = obj_list_head_new(member);
-		else
-			obj_list_add(members, member);
+		members = obj_list_add(members, member);
 
 	} while (dwarf_siblingof(&child_die, &child_die) == 0);
 
-	members->object = obj;
 	obj->member_list = members;
 done:
-	die_read_alignment(die, obj);
+	die_read_alignment(attrs, obj);
 	return obj;
 }
 
-static obj_list_head_t *print_subprogram_arguments(struct cu_ctx *ctx,
-						   struct record *rec,
-						   Dwarf_Die *die)
+static obj_list_t *print_subprogram_arguments(struct cu_ctx *ctx,
+					      struct record *rec,
+					      struct die_attrs *attrs)
 {
+	struct die_attrs child_attrs;
 	Dwarf_Die child_die;
 	obj_t *arg_type;
 	obj_t *arg;
-	obj_list_head_t *arg_list = NULL;
+	obj_list_t *arg_list = NULL;
 
-	if (!dwarf_haschildren(die))
+	if (!dwarf_haschildren(attrs->die))
 		return NULL;
 
 	/* Grab the first argument */
-	dwarf_child(die, &child_die);
+	dwarf_child(attrs->die, &child_die);
 
 	/* Walk all arguments until we run into the function body */
 	while ((dwarf_tag(&child_die) == DW_TAG_formal_parameter) ||
 	    (dwarf_tag(&child_die) == DW_TAG_unspecified_parameters)) {
-		const char *name = get_die_name(&child_die);
+		const char *name;
+
+		die_attrs_read(&child_die, &child_attrs);
+		name = get_die_name(&child_attrs);
 
-		if (dwarf_tag(&child_die) != DW_TAG_unspecified_parameters)
-			arg_type = print_die_type(ctx, rec, &child_die);
+		if (child_attrs.tag != DW_TAG_unspecified_parameters)
+			arg_type = print_die_type(ctx, rec, &child_attrs);
 		else
 			arg_type = obj_basetype_new(safe_strdup("..."));
 
 		arg = obj_var_new_add(safe_strdup(name), arg_type);
-		if (arg_list == NULL)
-			arg_list = obj_list_head_new(arg);
-		else
-			obj_list_add(arg_list, arg);
+		arg_list = obj_list_add(arg_list, arg);
 
 		if (dwarf_siblingof(&child_die, &child_die) != 0)
 			break;
@@ -1692,20 +2300,18 @@ static obj_list_head_t *print_subprogram_arguments(struct cu_ctx *ctx,
 
 static obj_t *print_die_subprogram(struct cu_ctx *ctx,
 				   struct record *rec,
-				   Dwarf_Die *die)
+				   struct die_attrs *attrs)
 {
 	char *name;
-	obj_list_head_t *arg_list;
+	obj_list_t *arg_list;
 	obj_t *ret_type;
 	obj_t *obj;
 
-	arg_list = print_subprogram_arguments(ctx, rec, die);
-	ret_type = print_die_type(ctx, rec, die);
-	name = safe_strdup(get_die_name(die));
+	arg_list = print_subprogram_arguments(ctx, rec, attrs);
+	ret_type = print_die_type(ctx, rec, attrs);
+	name = safe_strdup(get_die_name(attrs));
 
 	obj = obj_func_new_add(name, ret_type);
-	if (arg_list)
-		arg_list->object = obj;
 	obj->member_list = arg_list;
 	obj_fill_ns(obj, ctx, obj->name);
 
@@ -1717,11 +2323,10 @@ static obj_t *_print_die_array_type(struct cu_ctx *ctx,
 				    Dwarf_Die *child,
 				    obj_t *base_type)
 {
+	struct die_attrs attrs;
 	Dwarf_Die next_child;
 	Dwarf_Word value;
-	Dwarf_Attribute attr;
 	int rc;
-	unsigned int tag;
 	unsigned long arr_idx;
 	obj_t *obj;
 	obj_t *sub;
@@ -1729,19 +2334,18 @@ static obj_t *_print_die_array_type(struct cu_ctx *ctx,
 	if (child == NULL)
 		return base_type;
 
-	tag = dwarf_tag(child);
-	if (tag != DW_TAG_subrange_type)
+	die_attrs_read(child, &attrs);
+	if (attrs.tag != DW_TAG_subrange_type)
 		fail("Unexpected tag for array type children: %s\n",
-		     dwarf_tag_string(tag));
+		     dwarf_tag_string(attrs.tag));
 
-	if (dwarf_hasattr(child, DW_AT_upper_bound)) {
-		(void) dwarf_attr(child, DW_AT_upper_bound, &attr);
-		(void) dwarf_formudata(&attr, &value);
+	if (die_attrs_has(&attrs, DIE_ATTR_UPPER_BOUND)) {
+		(void) dwarf_formudata(&attrs.attr[DIE_ATTR_UPPER_BOUND],
+				       &value);
 		/* Get the UPPER bound, so add 1 */
 		arr_idx = value + 1;
-	} else if (dwarf_hasattr(child, DW_AT_count)) {
-		(void) dwarf_attr(child, DW_AT_count, &attr);
-		(void) dwarf_formudata(&attr, &value);
+	} else if (die_attrs_has(&attrs, DIE_ATTR_COUNT)) {
+		(void) dwarf_formudata(&attrs.attr[DIE_ATTR_COUNT], &value);
 		arr_idx = value;
 	} else {
 		arr_idx = 0;
@@ -1759,29 +2363,29 @@ static obj_t *_print_die_array_type(struct cu_ctx *ctx,
 
 static obj_t *print_die_array_type(struct cu_ctx *ctx,
 				   struct record *rec,
-				   Dwarf_Die *die)
+				   struct die_attrs *attrs)
 {
 	Dwarf_Die child;
 	obj_t *base_type;
 
 	/* There should be one child of DW_TAG_subrange_type */
-	if (!dwarf_haschildren(die))
+	if (!dwarf_haschildren(attrs->die))
 		fail("Array type missing children!\n");
 
-	base_type = print_die_type(ctx, rec, die);
+	base_type = print_die_type(ctx, rec, attrs);
 
 	/* Grab the child */
-	dwarf_child(die, &child);
+	dwarf_child(attrs->die, &child);
 
 	return _print_die_array_type(ctx, rec, &child, base_type);
 }
 
 static obj_t *print_die_tag(struct cu_ctx *ctx,
 			    struct record *rec,
-			    Dwarf_Die *die)
+			    struct die_attrs *attrs)
 {
-	unsigned int tag = dwarf_tag(die);
-	const char *name = dwarf_diename(die);
+	unsigned int tag = attrs->tag;
+	const char *name = die_attrs_name(attrs);
 	obj_t *obj = NULL;
 
 	if (tag == DW_TAG_invalid)
@@ -1789,10 +2393,10 @@ static obj_t *print_die_tag(struct cu_ctx *ctx,
 
 	switch (tag) {
 	case DW_TAG_subprogram:
-		obj = print_die_subprogram(ctx, rec, die);
+		obj = print_die_subprogram(ctx, rec, attrs);
 		break;
 	case DW_TAG_variable:
-		obj = print_die_type(ctx, rec, die);
+		obj = print_die_type(ctx, rec, attrs);
 		obj = obj_var_new_add(safe_strdup(name), obj);
 		obj_fill_ns(obj, ctx, obj->name);
 		break;
@@ -1800,40 +2404,40 @@ static obj_t *print_die_tag(struct cu_ctx *ctx,
 		obj = obj_basetype_new(safe_strdup(name));
 		break;
 	case DW_TAG_pointer_type:
-		obj = print_die_type(ctx, rec, die);
+		obj = print_die_type(ctx, rec, attrs);
 		obj = obj_ptr_new_add(obj);
 		break;
 	case DW_TAG_structure_type:
-		obj = print_die_structure(ctx, rec, die);
+		obj = print_die_structure(ctx, rec, attrs);
 		break;
 	case DW_TAG_enumeration_type:
-		obj = print_die_enumeration(ctx, rec, die);
+		obj = print_die_enumeration(ctx, rec, attrs);
 		break;
 	case DW_TAG_union_type:
-		obj = print_die_union(ctx, rec, die);
+		obj = print_die_union(ctx, rec, attrs);
 		break;
 	case DW_TAG_typedef:
-		obj = print_die_type(ctx, rec, die);
+		obj = print_die_type(ctx, rec, attrs);
 		obj = obj_typedef_new_add(safe_strdup(name), obj);
 		break;
 	case DW_TAG_subroutine_type:
-		obj = print_die_subprogram(ctx, rec, die);
+		obj = print_die_subprogram(ctx, rec, attrs);
 		break;
 	case DW_TAG_volatile_type:
-		obj = print_die_type(ctx, rec, die);
+		obj = print_die_type(ctx, rec, attrs);
 		obj = obj_qualifier_new_add(obj);
 		obj->base_type = global_string_get_copy("volatile");
 		break;
 	case DW_TAG_const_type:
-		obj = print_die_type(ctx, rec, die);
+		obj = print_die_type(ctx, rec, attrs);
 		obj = obj_qualifier_new_add(obj);
 		obj->base_type = global_string_get_copy("const");
 		break;
 	case DW_TAG_array_type:
-		obj = print_die_array_type(ctx, rec, die);
+		obj = print_die_array_type(ctx, rec, attrs);
 		break;
 	case DW_TAG_restrict_type:
-		obj = print_die_type(ctx, rec, die);
+		obj = print_die_type(ctx, rec, attrs);
 		obj = obj_qualifier_new_add(obj);
 		obj->base_type = global_string_get_copy("restrict");
 		break;
@@ -1848,18 +2452,66 @@ static obj_t *print_die_tag(struct cu_ctx *ctx,
 	}
 
 	if (tag != DW_TAG_subprogram && tag != DW_TAG_subroutine_type)
-		obj = die_read_byte_size(die, obj);
+		obj = die_read_byte_size(attrs, obj);
 
-	obj = die_read_alignment(die, obj);
+	obj = die_read_alignment(attrs, obj);
 	return obj;
 }
 
-static obj_t *print_die(struct cu_ctx *ctx,
-			struct record *parent_file,
-			Dwarf_Die *die)
+static int inline_type_link_cb(obj_t *o, void *arg)
+{
+	if (o->type == __type_reffile && !record_is_declaration(o->ref_record))
+		ilist_add_tail(&o->ref_record->dependents, &o->depend_link);
+
+	return CB_CONT;
+}
+
+/*
+ * The types without their own record are generated once per CU, as they
+ * come out the same every time. The next references get a copy of the
+ * tree kept in the CU arena, which shares its immutable subtrees.
+ */
+static obj_t *print_die_inline(struct cu_ctx *ctx,
+			       struct record *rec,
+			       struct die_attrs *attrs)
+{
+	Dwarf_Off off = dwarf_dieoffset(attrs->die);
+	struct arena *prev;
+	obj_t *kept;
+	obj_t *obj;
+
+	kept = cu_map_find(&ctx->inline_types, off);
+	if (kept != NULL) {
+		if (kept->is_shared)
+			return kept;
+
+		obj = obj_clone(kept);
+		obj_walk_tree(obj, inline_type_link_cb, NULL);
+		return obj;
+	}
+
+	obj = obj_share(print_die_tag(ctx, rec, attrs));
+
+	kept = obj;
+	if (!obj->is_shared) {
+		prev = obj_arena_set(&ctx->arena);
+		kept = obj_clone(obj);
+		obj_arena_set(prev);
+	}
+	cu_map_add(&ctx->inline_types, off, kept);
+
+	return obj;
+}
+
+static obj_t *_print_die(struct cu_ctx *ctx,
+			 struct record *parent_file,
+			 struct die_attrs *attrs)
 {
-	char *file;
+	Dwarf_Off off = dwarf_dieoffset(attrs->die);
+	const char *key;
 	struct record *rec;
+	struct record_list *rec_list;
+	struct arena *prev;
 	obj_t *obj;
 	obj_t *ref_obj;
 	generate_config_t *conf = ctx->conf;
@@ -1873,31 +2525,42 @@ static obj_t *print_die(struct cu_ctx *ctx,
 	 * occasion.
 	 */
 
-	/* Check if we need to redirect output or we have a mere declaration */
-	file = get_symbol_file(die, ctx->cu_die);
-	if (file == NULL) {
-		/* no need for new record, output to the current one */
-		assert(parent_file != NULL);
-		obj = print_die_tag(ctx, parent_file, die);
-		return obj;
+	/*
+	 * Check if we need to redirect output or we have a mere declaration.
+	 * The record list of the key is kept by the DIE offset, so the key is
+	 * built and looked up in the db only once per CU.
+	 */
+	rec_list = cu_map_find(&ctx->keys, off);
+	if (rec_list == NULL) {
+		char *file = get_symbol_file(attrs);
+
+		if (file == NULL) {
+			/* no need for new record, output to the current one */
+			assert(parent_file != NULL);
+			return print_die_inline(ctx, parent_file, attrs);
+		}
+
+		rec_list = record_db_lookup_or_init(conf->db, file);
+		free(file);
+		cu_map_add(&ctx->keys, off, rec_list);
 	}
+	key = rec_list->key;
 
 	ref_obj = obj_reffile_new();
 
 	/* else handle new record */
-	rec = record_start(ctx, die, file);
+	rec = record_start(ctx, attrs, rec_list, key);
 	if (rec == NULL) {
 		/* declaration or already processed */
-		struct record_list *rec_list
-			= record_db_lookup_or_init(conf->db, file);
-
-		if (is_declaration(die)) {
+		if (is_declaration(attrs)) {
 			ref_obj->ref_record = record_list_decl_dummy(rec_list);
 		} else {
-			struct record *processed = hash_find(cu_db, file);
+			struct record *processed
+				= cu_map_find(&ctx->processed,
+						  rec_list->id);
 
-			ref_obj->depend_rec_node
-				= list_add(&processed->dependents, ref_obj);
+			ilist_add_tail(&processed->dependents,
+				       &ref_obj->depend_link);
 			ref_obj->ref_record = processed;
 		}
 
@@ -1907,42 +2570,229 @@ static obj_t *print_die(struct cu_ctx *ctx,
 	hash_add(cu_db, rec->key, rec);
 
 	if (conf->gen_extra)
-		stack_push(ctx->stack, safe_strdup(file));
-	obj = print_die_tag(ctx, rec, die);
+		stack_push(ctx->stack, safe_strdup(key));
+	prev = obj_arena_set(&rec->arena);
+	obj = print_die_tag(ctx, rec, attrs);
+	obj_arena_set(prev);
 	if (conf->gen_extra)
 		free(stack_pop(ctx->stack));
 
 	record_close(rec, obj);
 
-	ref_obj->depend_rec_node = list_add(&rec->dependents, ref_obj);
+	ilist_add_tail(&rec->dependents, &ref_obj->depend_link);
 	ref_obj->ref_record = rec;
 
 out:
-	free(file);
-
 	return ref_obj;
 }
 
+static obj_t *print_die(struct cu_ctx *ctx,
+			struct record *parent_file,
+			Dwarf_Die *die)
+{
+	struct die_attrs attrs;
+
+	die_attrs_read(die, &attrs);
+	return _print_die(ctx, parent_file, &attrs);
+}
+
+/*
+ * A generate job processes a single kernel module. The jobs are created in
+ * the directory walk order and their results are folded into the record db
+ * in the same order, so the output doesn't depend on the number of threads.
+ */
+struct gen_job {
+	char *path;
+	unsigned int index;
+	unsigned int endianness;
+	struct ksymtab *ksymtab;
+	struct ksymtab *aliases;
+	bool skip; /* Nothing to generate for this module */
+	char *build_id;
+	FILE *cache; /* Cache file being written, if any */
+	char *cache_path;
+	char *cache_tmp;
+
+	/*
+	 * Results waiting for the folding thread. The lists are allocated
+	 * only when running in parallel, otherwise the results go directly
+	 * to the db.
+	 */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct list *cu_dbs;
+	struct list *records;
+	struct list *marks; /* Symbols of conf->symbols to mark */
+	bool done;
+};
+
+/*
+ * With multiple threads the CUs of a module are processed in parallel too.
+ * The results of each CU are kept aside until the job thread hands them
+ * over in the CU order.
+ */
+struct cu_job {
+	Dwarf_Die cu_die;
+	Dwarf_Off offset;
+	Dwarf_Off size;
+	unsigned char dw_version;
+	struct list cu_dbs;
+	struct list marks; /* Symbols of conf->symbols to mark */
+	struct list exported_marks; /* Symbols of the module ksymtab to mark */
+	bool done;
+};
+
+struct cu_jobs {
+	struct file_ctx *fctx;
+	struct cu_job *cus;
+	struct cu_job **order; /* Processing order, the largest CUs first */
+	size_t cnt;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+struct gen_jobs {
+	generate_config_t *conf;
+	struct gen_job **jobs;
+	size_t cnt;
+	size_t last; /* The last job folded into the db */
+};
+
+static bool generate_cancelled(generate_config_t *conf)
+{
+	return __atomic_load_n(&conf->cancel, __ATOMIC_RELAXED);
+}
+
+static void cu_db_free(void *value)
+{
+	struct hash *cu_db = value;
+	struct hash_iter iter;
+	const void *val;
+
+	hash_iter_init(cu_db, &iter);
+	while (hash_iter_next(&iter, NULL, &val))
+		record_put((struct record *)val);
+	hash_free(cu_db);
+}
+
+static void job_add_cu(struct file_ctx *fctx, struct hash *cu_db)
+{
+	struct gen_job *job = fctx->job;
+
+	if (fctx->cu != NULL) {
+		list_add(&fctx->cu->cu_dbs, cu_db);
+		return;
+	}
+
+	if (job->cache != NULL)
+		cache_write_cu(job->cache, cu_db);
+
+	if (job->cu_dbs == NULL) {
+		record_db_add_cu(fctx->conf->db, cu_db);
+		hash_free(cu_db);
+		return;
+	}
+
+	pthread_mutex_lock(&job->lock);
+	list_add(job->cu_dbs, cu_db);
+	pthread_cond_signal(&job->cond);
+	pthread_mutex_unlock(&job->lock);
+}
+
+static void job_add_record(struct file_ctx *fctx, struct record *rec)
+{
+	struct gen_job *job = fctx->job;
+	char *new_key;
+
+	if (job->cache != NULL)
+		cache_write_record(job->cache, rec);
+
+	if (job->records == NULL) {
+		new_key = record_db_add(fctx->conf->db, rec);
+		record_put(rec);
+		free(new_key);
+		return;
+	}
+
+	list_add(job->records, rec);
+}
+
+static void job_mark(struct file_ctx *fctx, struct ksym *ksym)
+{
+	struct gen_job *job = fctx->job;
+
+	if (fctx->cu != NULL) {
+		list_add(&fctx->cu->marks, ksym);
+		return;
+	}
+
+	if (job->cache != NULL)
+		cache_write_mark(job->cache, ksymtab_ksym_get_name(ksym));
+
+	if (job->marks == NULL) {
+		ksymtab_ksym_mark(ksym);
+		return;
+	}
+
+	list_add(job->marks, ksym);
+}
+
+static void job_mark_exported(struct file_ctx *fctx, struct ksym *ksym)
+{
+	if (fctx->cu != NULL) {
+		list_add(&fctx->cu->exported_marks, ksym);
+		return;
+	}
+
+	ksymtab_ksym_mark(ksym);
+}
+
+/*
+ * The aliases of all the modules are added to conf->symbols before the
+ * modules are processed in parallel. Hide the ones which wouldn't have
+ * been added yet when processing the modules one by one.
+ */
+static struct ksym *symbols_find(struct file_ctx *fctx, const char *name)
+{
+	struct ksym *ksym = ksymtab_find(fctx->conf->symbols, name);
+
+	if (ksym != NULL && ksym->gen > fctx->job->index)
+		return NULL;
+
+	return ksym;
+}
+
 /*
  * Validate if this is the symbol we should print.
  * Returns true if should.
  */
 static bool is_symbol_valid(struct file_ctx *fctx, Dwarf_Die *die)
 {
-	const char *name = dwarf_diename(die);
+	const char *name;
 	unsigned int tag = dwarf_tag(die);
 	bool result = false;
 	generate_config_t *conf = fctx->conf;
 	struct ksym *ksym1 = NULL;
 	struct ksym *ksym2;
+	struct die_attrs attrs;
+	uint64_t name_hash;
 
 	/* Shortcut, unnamed die cannot be part of stablelist */
+	name = dwarf_diename(die);
 	if (name == NULL)
 		goto out;
 
+	/* Most of the names are on neither list, reject them by the filters */
+	name_hash = ksymtab_filter_hash(name);
+	if (conf->symbols != NULL &&
+	    !ksymtab_filter_test(conf->symbols, name_hash))
+		goto out;
+	if (!ksymtab_filter_test(fctx->ksymtab, name_hash))
+		goto out;
+
 	/* If symbol file was provided, is the symbol on the list? */
 	if (conf->symbols != NULL) {
-		ksym1 = ksymtab_find(conf->symbols, name);
+		ksym1 = symbols_find(fctx, name);
 		if (ksym1 == NULL)
 			goto out;
 	}
@@ -1953,7 +2803,8 @@ static bool is_symbol_valid(struct file_ctx *fctx, Dwarf_Die *die)
 		goto out;
 
 	/* We don't care about declarations */
-	if (is_declaration(die))
+	die_attrs_read(die, &attrs);
+	if (is_declaration(&attrs))
 		goto out;
 	/*
 	 * Mark the symbol as not eligible to fake symbol generation.
@@ -1961,10 +2812,10 @@ static bool is_symbol_valid(struct file_ctx *fctx, Dwarf_Die *die)
 	 * because it may have dwarf info for its C declaration,
 	 * but others in dwarf are supposed to be normal C functions.
 	 */
-	ksymtab_ksym_mark(ksym2);
+	job_mark_exported(fctx, ksym2);
 
 	/* Anything EXPORT_SYMBOLed should be external */
-	if (!is_external(die))
+	if (!is_external(&attrs))
 		goto out;
 
 	/* We expect only variables or functions on stablelist */
@@ -1997,7 +2848,7 @@ static bool is_symbol_valid(struct file_ctx *fctx, Dwarf_Die *die)
 	 * but the decision is made here.
 	 */
 	if (conf->symbols != NULL)
-		ksymtab_ksym_mark(ksym1);
+		job_mark(fctx, ksym1);
 
 out:
 	return result;
@@ -2005,7 +2856,11 @@ out:
 
 /*
  * Walk all DIEs in a CU.
- * Returns true if the given symbol_name was found, otherwise false.
+ * The types are shared by all the symbols of the CU, so they are generated
+ * only once per CU and the whole CU is added to the db at once.
+ * The records are merged in a different order than when every symbol had
+ * its own CU db, so the versions of a type with several unmerged records
+ * can be numbered differently than by the older releases.
  */
 static void process_cu_die(Dwarf_Die *cu_die, struct file_ctx *fctx)
 {
@@ -2013,6 +2868,8 @@ static void process_cu_die(Dwarf_Die *cu_die, struct file_ctx *fctx)
 	bool cu_printed = false;
 	obj_t *ref;
 	generate_config_t *conf = fctx->conf;
+	struct cu_ctx ctx;
+	void *data;
 
 	if (!dwarf_haschildren(cu_die))
 		return;
@@ -2020,79 +2877,533 @@ static void process_cu_die(Dwarf_Die *cu_die, struct file_ctx *fctx)
 	/* Walk all DIEs in the CU */
 	dwarf_child(cu_die, &child_die);
 	do {
-		void *data;
-		struct cu_ctx ctx;
-
 		if (!is_symbol_valid(fctx, &child_die))
 			continue;
 
-		if (!cu_printed && conf->verbose) {
-			printf("Processing CU %s\n",
-			       dwarf_diename(cu_die));
+		if (!cu_printed) {
+			if (conf->verbose)
+				printf("Processing CU %s\n",
+				       dwarf_diename(cu_die));
 			cu_printed = true;
-		}
 
-		ctx.dw_version = fctx->dw_version;
-		ctx.elf_endian = fctx->elf_endian;
-		ctx.conf = conf;
-		ctx.cu_die = cu_die;
-		ctx.ksymtab = (struct ksymtab *) fctx->ksymtab;
+			ctx.dw_version = fctx->dw_version;
+			ctx.elf_endian = fctx->elf_endian;
+			ctx.conf = conf;
+			ctx.cu_die = cu_die;
+			ctx.ksymtab = (struct ksymtab *) fctx->ksymtab;
 
-		/* Grab a fresh stack of symbols */
-		ctx.stack = stack_init();
-		/* And a set of all processed symbols */
-		ctx.processed = set_init(PROCESSED_SIZE);
+			/* Grab a fresh stack of symbols */
+			ctx.stack = stack_init();
+			/* And tables of all processed symbols and types */
+			memset(&ctx.processed, 0, sizeof(ctx.processed));
+			memset(&ctx.inline_types, 0, sizeof(ctx.inline_types));
+			memset(&ctx.keys, 0, sizeof(ctx.keys));
+			memset(&ctx.files, 0, sizeof(ctx.files));
 
-		ctx.cu_db = hash_new(PROCESSED_SIZE, NULL);
+			ctx.cu_db = hash_new(PROCESSED_SIZE, NULL);
+
+			arena_init(&ctx.arena, OBJ_ARENA_CHUNK_SIZE);
+			obj_arena_set(&ctx.arena);
+		}
 
 		/* Print both the CU DIE and symbol DIE */
 		ref = print_die(&ctx, NULL, &child_die);
-		record_db_add_cu(conf->db, ctx.cu_db);
+		obj_detach(ref);
+	} while (dwarf_siblingof(&child_die, &child_die) == 0);
 
-		obj_free(ref);
+	if (!cu_printed)
+		return;
 
-		/* And clear the stack again */
-		while ((data = stack_pop(ctx.stack)) != NULL)
-			free(data);
+	obj_arena_set(NULL);
+	arena_free(&ctx.arena);
 
-		stack_destroy(ctx.stack);
-		set_free(ctx.processed);
+	job_add_cu(fctx, ctx.cu_db);
 
-		hash_free((struct hash *)ctx.cu_db);
-	} while (dwarf_siblingof(&child_die, &child_die) == 0);
+	/* And clear the stack again */
+	while ((data = stack_pop(ctx.stack)) != NULL)
+		free(data);
+
+	stack_destroy(ctx.stack);
+	cu_map_free(&ctx.processed);
+	cu_map_free(&ctx.inline_types);
+	cu_map_free(&ctx.keys);
+	cu_map_free(&ctx.files);
 }
 
-static int dwflmod_generate_cb(Dwfl_Module *dwflmod, void **userdata,
-		const char *name, Dwarf_Addr base, void *arg)
+static int cu_job_cmp(const void *a, const void *b)
 {
-	Dwarf_Addr dwbias;
-	Dwarf *dbg = dwfl_module_getdwarf(dwflmod, &dwbias);
-	struct file_ctx *fctx = (struct file_ctx *)arg;
+	const struct cu_job *cu1 = *(const struct cu_job **)a;
+	const struct cu_job *cu2 = *(const struct cu_job **)b;
 
-	if (*userdata != NULL)
-		fail("Multiple modules found in %s!\n", name);
-	*userdata = dwflmod;
+	if (cu1->size != cu2->size)
+		return cu1->size < cu2->size ? 1 : -1;
+	return cu1->offset < cu2->offset ? -1 : 1;
+}
 
-	Dwarf_Off off = 0;
-	Dwarf_Off old_off = 0;
-	Dwarf_Off type_offset = 0;
-	Dwarf_Half version;
-	size_t hsize;
-	Dwarf_Off abbrev;
-	uint8_t addresssize;
-	uint8_t offsetsize;
+static void cu_job_cb(size_t i, void *arg)
+{
+	struct cu_jobs *cus = arg;
+	struct cu_job *cu = cus->order[i];
+	struct file_ctx fctx = *cus->fctx;
 
-	while (dwarf_next_unit(dbg, off, &off, &hsize, &version, &abbrev,
-	    &addresssize, &offsetsize, NULL, &type_offset) == 0) {
-		fctx->dw_version = version;
+	fctx.cu = cu;
+	fctx.dw_version = cu->dw_version;
 
-		if (version < 2 || version > 5)
-			fail("Unsupported dwarf version: %d\n", version);
+	if (!generate_cancelled(fctx.conf))
+		process_cu_die(&cu->cu_die, &fctx);
 
-		/* CU is followed by a single DIE */
-		Dwarf_Die cu_die;
-		if (dwarf_offdie(dbg, old_off + hsize, &cu_die) == NULL) {
-			fail("dwarf_offdie failed for cu!\n");
+	pthread_mutex_lock(&cus->lock);
+	cu->done = true;
+	pthread_cond_broadcast(&cus->cond);
+	pthread_mutex_unlock(&cus->lock);
+}
+
+/* Could the symbol produce a record or a mark in this module? */
+static bool is_symbol_wanted(struct file_ctx *fctx, const char *name)
+{
+	if (ksymtab_find(fctx->ksymtab, name) == NULL)
+		return false;
+
+	if (fctx->conf->symbols != NULL && symbols_find(fctx, name) == NULL)
+		return false;
+
+	return true;
+}
+
+struct wanted_count_ctx {
+	struct file_ctx *fctx;
+	size_t cnt;
+};
+
+static void wanted_count_cb(struct ksym *ksym, void *arg)
+{
+	struct wanted_count_ctx *ctx = arg;
+
+	if (is_symbol_wanted(ctx->fctx, ksymtab_ksym_get_name(ksym)))
+		ctx->cnt++;
+}
+
+static int dwarf_off_cmp(const void *a, const void *b)
+{
+	Dwarf_Off o1 = *(const Dwarf_Off *)a;
+	Dwarf_Off o2 = *(const Dwarf_Off *)b;
+
+	return (o1 > o2) - (o1 < o2);
+}
+
+static void dwarf_off_add(Dwarf_Off **offs, size_t *cnt, size_t *alloc,
+			  Dwarf_Off off)
+{
+	if (*cnt == *alloc) {
+		*alloc = *alloc ? *alloc * 2 : 64;
+		*offs = safe_realloc(*offs, *alloc * sizeof(**offs));
+	}
+	(*offs)[(*cnt)++] = off;
+}
+
+static void dwarf_off_sort_uniq(Dwarf_Off *offs, size_t *cnt)
+{
+	size_t i, j;
+
+	qsort(offs, *cnt, sizeof(*offs), dwarf_off_cmp);
+	for (i = 0, j = 0; i < *cnt; i++) {
+		if (j == 0 || offs[j - 1] != offs[i])
+			offs[j++] = offs[i];
+	}
+	*cnt = j;
+}
+
+static void cu_filter_free(struct cu_filter *filter)
+{
+	if (filter == NULL)
+		return;
+
+	free(filter->offs);
+	free(filter->indexed);
+	free(filter);
+}
+
+struct index_filter_ctx {
+	struct file_ctx *fctx;
+	struct cu_filter *filter;
+};
+
+static void index_filter_name_cb(const char *name, Dwarf_Off cu_off,
+				 void *arg)
+{
+	struct index_filter_ctx *ctx = arg;
+	struct cu_filter *filter = ctx->filter;
+
+	if (is_symbol_wanted(ctx->fctx, name))
+		dwarf_off_add(&filter->offs, &filter->cnt, &filter->alloc,
+			      cu_off);
+}
+
+static void index_filter_cu_cb(Dwarf_Off cu_off, void *arg)
+{
+	struct index_filter_ctx *ctx = arg;
+	struct cu_filter *filter = ctx->filter;
+
+	dwarf_off_add(&filter->indexed, &filter->indexed_cnt,
+		      &filter->indexed_alloc, cu_off);
+}
+
+/*
+ * Find the CUs defining the wanted symbols in the .debug_names or
+ * .gdb_index section. Unlike the address ranges, the index covers the
+ * variables too. Returns NULL if there is no usable index.
+ */
+static struct cu_filter *cu_filter_from_index(Dwarf *dbg,
+					      struct file_ctx *fctx)
+{
+	struct index_filter_ctx ctx;
+
+	ctx.fctx = fctx;
+	ctx.filter = safe_zmalloc(sizeof(*ctx.filter));
+
+	if (!name_index_walk(dbg, index_filter_name_cb, index_filter_cu_cb,
+			     &ctx) || ctx.filter->indexed_cnt == 0) {
+		cu_filter_free(ctx.filter);
+		return NULL;
+	}
+
+	dwarf_off_sort_uniq(ctx.filter->offs, &ctx.filter->cnt);
+	dwarf_off_sort_uniq(ctx.filter->indexed, &ctx.filter->indexed_cnt);
+
+	return ctx.filter;
+}
+
+/*
+ * Find the CUs defining the exported functions by their addresses.
+ * The address ranges only cover code, so if any of the wanted symbols is
+ * not a function, or there are no ranges at all, returns NULL and all the
+ * CUs have to be walked. The ranges are often incomplete (eg. missing for
+ * the CUs built by clang or stripped by objcopy), so a function without
+ * any range covering its address makes all the CUs walked as well.
+ */
+static struct cu_filter *cu_filter_from_aranges(Dwfl_Module *dwflmod,
+						Dwarf *dbg,
+						struct file_ctx *fctx)
+{
+	struct wanted_count_ctx ctx;
+	struct cu_filter *filter;
+	Dwarf_Aranges *aranges;
+	size_t naranges;
+	size_t found = 0;
+	size_t i;
+	int nsyms;
+
+	if (dwarf_getaranges(dbg, &aranges, &naranges) != 0 ||
+	    naranges == 0)
+		return NULL;
+
+	nsyms = dwfl_module_getsymtab(dwflmod);
+	if (nsyms <= 0)
+		return NULL;
+
+	ctx.fctx = fctx;
+	ctx.cnt = 0;
+	ksymtab_for_each(fctx->ksymtab, wanted_count_cb, &ctx);
+
+	filter = safe_zmalloc(sizeof(*filter));
+
+	for (i = 1; i < nsyms; i++) {
+		const char *name;
+		GElf_Sym sym;
+		GElf_Addr addr;
+		Dwarf_Addr bias;
+		Dwarf_Die *cu_die;
+
+		name = dwfl_module_getsym_info(dwflmod, i, &sym, &addr,
+					       NULL, NULL, NULL);
+		if (name == NULL || GELF_ST_BIND(sym.st_info) == STB_LOCAL)
+			continue;
+		if (!is_symbol_wanted(fctx, name))
+			continue;
+		if (GELF_ST_TYPE(sym.st_info) != STT_FUNC)
+			goto walk_all;
+
+		found++;
+
+		cu_die = dwfl_module_addrdie(dwflmod, addr, &bias);
+		if (cu_die == NULL)
+			goto walk_all;
+
+		/* The CU header precedes its DIE */
+		dwarf_off_add(&filter->offs, &filter->cnt, &filter->alloc,
+			      dwarf_dieoffset(cu_die) - dwarf_cuoffset(cu_die));
+	}
+
+	/* Some of the wanted symbols are not in the symbol table */
+	if (found != ctx.cnt)
+		goto walk_all;
+
+	dwarf_off_sort_uniq(filter->offs, &filter->cnt);
+
+	return filter;
+
+walk_all:
+	cu_filter_free(filter);
+	return NULL;
+}
+
+/* Should the CU starting at the offset be processed? */
+static bool cu_filter_match(struct cu_filter *filter, Dwarf_Off cu_off)
+{
+	if (filter == NULL)
+		return true;
+
+	if (bsearch(&cu_off, filter->offs, filter->cnt, sizeof(cu_off),
+		    dwarf_off_cmp) != NULL)
+		return true;
+
+	return filter->indexed != NULL &&
+		bsearch(&cu_off, filter->indexed, filter->indexed_cnt,
+			sizeof(cu_off), dwarf_off_cmp) == NULL;
+}
+
+static void unmarked_count_cb(struct ksym *ksym, void *arg)
+{
+	struct wanted_count_ctx *ctx = arg;
+
+	if (!ksymtab_ksym_is_marked(ksym) &&
+	    is_symbol_wanted(ctx->fctx, ksymtab_ksym_get_name(ksym)))
+		ctx->cnt++;
+}
+
+/*
+ * Any definition with the name of a wanted export marks it as found in the
+ * debug info, even if it's not the one generating its record. The CUs the
+ * filter skipped can hold such a definition, so if some wanted export is
+ * still not marked, mark it from their DIEs. Otherwise it would get an
+ * assembly record which the walk of all the CUs doesn't generate.
+ */
+static void cu_filter_mark_skipped(Dwarf *dbg, struct file_ctx *fctx)
+{
+	struct wanted_count_ctx ctx;
+	struct die_attrs attrs;
+	Dwarf_Die cu_die;
+	Dwarf_Die die;
+	const char *name;
+	Dwarf_Off off = 0;
+	Dwarf_Off old_off = 0;
+	size_t hsize;
+
+	ctx.fctx = fctx;
+	ctx.cnt = 0;
+	ksymtab_for_each(fctx->ksymtab, unmarked_count_cb, &ctx);
+	if (ctx.cnt == 0)
+		return;
+
+	while (dwarf_next_unit(dbg, off, &off, &hsize, NULL, NULL, NULL,
+			       NULL, NULL, NULL) == 0) {
+		if (cu_filter_match(fctx->cu_filter, old_off) ||
+		    dwarf_offdie(dbg, old_off + hsize, &cu_die) == NULL ||
+		    dwarf_child(&cu_die, &die) != 0) {
+			old_off = off;
+			continue;
+		}
+
+		do {
+			name = dwarf_diename(&die);
+			if (name == NULL || !is_symbol_wanted(fctx, name))
+				continue;
+			die_attrs_read(&die, &attrs);
+			if (!is_declaration(&attrs))
+				job_mark_exported(fctx,
+						  ksymtab_find(fctx->ksymtab,
+							       name));
+		} while (dwarf_siblingof(&die, &die) == 0);
+
+		old_off = off;
+	}
+}
+
+/*
+ * libdw doesn't lock the data it reads lazily: its tree of the CUs and
+ * the line tables. Look up every unit and read its line table, so that
+ * the CU workers only find what's already there. This includes the units
+ * the CU filter skips, the references can point to any of them.
+ */
+static void dwarf_preload(Dwarf *dbg)
+{
+	Dwarf_Off off = 0;
+	Dwarf_Off old_off = 0;
+	Dwarf_Half version;
+	size_t hsize;
+	Dwarf_Die cu_die;
+	Dwarf_Files *files;
+	size_t nfiles;
+
+	while (dwarf_next_unit(dbg, off, &off, &hsize, &version, NULL, NULL,
+			       NULL, NULL, NULL) == 0) {
+		/* Reported by the caller */
+		if (version < 2 || version > 5)
+			return;
+
+		if (dwarf_offdie(dbg, old_off + hsize, &cu_die) == NULL)
+			fail("dwarf_offdie failed for cu!\n");
+		/* Fails for the units without a line table, which is fine */
+		dwarf_getsrcfiles(&cu_die, &files, &nfiles);
+		old_off = off;
+	}
+}
+
+/*
+ * Process the CUs in parallel, the largest ones first, and hand over their
+ * results in the CU order, the same one as the serial walk uses.
+ * All the units of the module and of its alternate debug file are read
+ * by dwarf_preload() before starting the workers.
+ */
+static void process_cus_parallel(Dwarf *dbg, struct file_ctx *fctx)
+{
+	struct cu_jobs cus;
+	struct threadpool *pool;
+	struct list_node *iter;
+	size_t alloc = 0;
+	size_t i;
+
+	Dwarf_Off off = 0;
+	Dwarf_Off old_off = 0;
+	Dwarf_Off type_offset = 0;
+	Dwarf_Half version;
+	size_t hsize;
+	Dwarf_Off abbrev;
+	uint8_t addresssize;
+	uint8_t offsetsize;
+
+	cus.fctx = fctx;
+	cus.cus = NULL;
+	cus.cnt = 0;
+
+	dwarf_preload(dbg);
+	if (dwarf_getalt(dbg) != NULL)
+		dwarf_preload(dwarf_getalt(dbg));
+
+	while (dwarf_next_unit(dbg, off, &off, &hsize, &version, &abbrev,
+	    &addresssize, &offsetsize, NULL, &type_offset) == 0) {
+		struct cu_job *cu;
+
+		if (version < 2 || version > 5)
+			fail("Unsupported dwarf version: %d\n", version);
+
+		if (!cu_filter_match(fctx->cu_filter, old_off)) {
+			old_off = off;
+			continue;
+		}
+
+		if (cus.cnt == alloc) {
+			alloc = alloc ? alloc * 2 : 64;
+			cus.cus = safe_realloc(cus.cus,
+					       alloc * sizeof(*cus.cus));
+		}
+		cu = &cus.cus[cus.cnt++];
+		memset(cu, 0, sizeof(*cu));
+
+		/* CU is followed by a single DIE */
+		if (dwarf_offdie(dbg, old_off + hsize, &cu->cu_die) == NULL)
+			fail("dwarf_offdie failed for cu!\n");
+
+		cu->offset = old_off;
+		cu->size = off - old_off;
+		cu->dw_version = version;
+		list_init(&cu->cu_dbs, NULL);
+		list_init(&cu->marks, NULL);
+		list_init(&cu->exported_marks, NULL);
+
+		old_off = off;
+	}
+
+	cus.order = safe_zmalloc(cus.cnt * sizeof(*cus.order));
+	for (i = 0; i < cus.cnt; i++)
+		cus.order[i] = &cus.cus[i];
+	qsort(cus.order, cus.cnt, sizeof(*cus.order), cu_job_cmp);
+
+	pthread_mutex_init(&cus.lock, NULL);
+	pthread_cond_init(&cus.cond, NULL);
+
+	pool = threadpool_start(fctx->conf->cu_jobs, cus.cnt, cu_job_cb, &cus);
+
+	for (i = 0; i < cus.cnt; i++) {
+		struct cu_job *cu = &cus.cus[i];
+
+		pthread_mutex_lock(&cus.lock);
+		while (!cu->done)
+			pthread_cond_wait(&cus.cond, &cus.lock);
+		pthread_mutex_unlock(&cus.lock);
+
+		LIST_FOR_EACH(&cu->cu_dbs, iter)
+			job_add_cu(fctx, list_node_data(iter));
+		LIST_FOR_EACH(&cu->marks, iter)
+			job_mark(fctx, list_node_data(iter));
+		LIST_FOR_EACH(&cu->exported_marks, iter)
+			job_mark_exported(fctx, list_node_data(iter));
+
+		list_clear(&cu->cu_dbs);
+		list_clear(&cu->marks);
+		list_clear(&cu->exported_marks);
+	}
+
+	threadpool_join(pool);
+
+	pthread_mutex_destroy(&cus.lock);
+	pthread_cond_destroy(&cus.cond);
+	free(cus.order);
+	free(cus.cus);
+}
+
+static int dwflmod_generate_cb(Dwfl_Module *dwflmod, void **userdata,
+		const char *name, Dwarf_Addr base, void *arg)
+{
+	Dwarf_Addr dwbias;
+	Dwarf *dbg = dwfl_module_getdwarf(dwflmod, &dwbias);
+	struct file_ctx *fctx = (struct file_ctx *)arg;
+
+	if (*userdata != NULL)
+		fail("Multiple modules found in %s!\n", name);
+	*userdata = dwflmod;
+
+	fctx->cu_filter = cu_filter_from_index(dbg, fctx);
+	if (fctx->cu_filter == NULL)
+		fctx->cu_filter = cu_filter_from_aranges(dwflmod, dbg, fctx);
+
+	if (fctx->conf->cu_jobs > 1) {
+		process_cus_parallel(dbg, fctx);
+		if (fctx->cu_filter != NULL && !generate_cancelled(fctx->conf))
+			cu_filter_mark_skipped(dbg, fctx);
+		cu_filter_free(fctx->cu_filter);
+		fctx->cu_filter = NULL;
+		return DWARF_CB_OK;
+	}
+
+	Dwarf_Off off = 0;
+	Dwarf_Off old_off = 0;
+	Dwarf_Off type_offset = 0;
+	Dwarf_Half version;
+	size_t hsize;
+	Dwarf_Off abbrev;
+	uint8_t addresssize;
+	uint8_t offsetsize;
+
+	while (dwarf_next_unit(dbg, off, &off, &hsize, &version, &abbrev,
+	    &addresssize, &offsetsize, NULL, &type_offset) == 0) {
+		if (generate_cancelled(fctx->conf))
+			break;
+
+		fctx->dw_version = version;
+
+		if (version < 2 || version > 5)
+			fail("Unsupported dwarf version: %d\n", version);
+
+		if (!cu_filter_match(fctx->cu_filter, old_off)) {
+			old_off = off;
+			continue;
+		}
+
+		/* CU is followed by a single DIE */
+		Dwarf_Die cu_die;
+		if (dwarf_offdie(dbg, old_off + hsize, &cu_die) == NULL) {
+			fail("dwarf_offdie failed for cu!\n");
 		}
 
 		process_cu_die(&cu_die, fctx);
@@ -2100,6 +3411,11 @@ static int dwflmod_generate_cb(Dwfl_Module *dwflmod, void **userdata,
 		old_off = off;
 	}
 
+	if (fctx->cu_filter != NULL && !generate_cancelled(fctx->conf))
+		cu_filter_mark_skipped(dbg, fctx);
+	cu_filter_free(fctx->cu_filter);
+	fctx->cu_filter = NULL;
+
 	return DWARF_CB_OK;
 }
 
@@ -2129,338 +3445,775 @@ static bool is_all_done(generate_config_t *conf)
 	return ksymtab_mark_count(conf->symbols) == conf->symbol_cnt;
 }
 
-static void generate_assembly_record(generate_config_t *conf, const char *key)
+static void generate_assembly_record(struct file_ctx *fctx, const char *key)
 {
 	struct record *rec;
-	char *new_key, *name;
+	char *name;
 
-	if (conf->verbose)
+	if (fctx->conf->verbose)
 		printf("Generating assembly record for %s\n", key);
 
 	safe_asprintf(&name, "asm--%s", key);
 
 	rec = record_new_assembly(name);
-	new_key = record_db_add(conf->db, rec);
+	job_add_record(fctx, rec);
 
-	record_put(rec);
 	free(name);
-	free(new_key);
 }
 
-static bool try_generate_alias(generate_config_t *conf, struct ksym *ksym)
+static bool try_generate_alias(struct file_ctx *fctx, struct ksym *ksym)
 {
 	char *link = ksymtab_ksym_get_link(ksym);
 	const char *key = ksymtab_ksym_get_name(ksym);
 	struct record *rec;
-	char *new_key, *name;
+	char *name;
+
+	if (!link)
+		return false;
+
+	if (fctx->conf->verbose)
+		printf("Generating weak record %s -> %s\n",
+		       key, link);
+
+	safe_asprintf(&name, "weak--%s", key);
+
+	rec = record_new_weak(name, link);
+	job_add_record(fctx, rec);
+
+	free(name);
+
+	return true;
+}
+
+/*
+ * process_not_found:
+ *
+ * Generate fake records for symbols, not found in the debug info,
+ * but existed in the export list (most probably, assembly function).
+ *
+ * If there is a checklist, mark the symbol there (as processed).
+ * If the symbol not in the checklist, ignore it completely,
+ * means, do not mark and do not generate fake record for it either.
+ */
+static void process_not_found(struct ksym *exported, void *ctx)
+{
+	struct file_ctx *fctx = ctx;
+	struct ksym *ksym;
+	const char *key = ksymtab_ksym_get_name(exported);
+
+	if (ksymtab_ksym_is_marked(exported))
+		return;
+
+	if (fctx->conf->symbols) {
+		ksym = symbols_find(fctx, key);
+		if (ksym == NULL)
+			return;
+		job_mark(fctx, ksym);
+	}
+
+	if (!try_generate_alias(fctx, exported))
+		generate_assembly_record(fctx, key);
+}
+
+struct alias_ctx {
+	struct ksymtab *symbols;
+	unsigned int gen;
+};
+
+static void ksymtab_add_alias(struct ksym *ksym, void *_ctx)
+{
+	struct alias_ctx *ctx = _ctx;
+	struct ksym *new;
+
+	/*
+	 * Don't replace the symbol if it's already there, the workers may
+	 * hold a pointer to it.
+	 */
+	if (ksymtab_find(ctx->symbols, ksymtab_ksym_get_name(ksym)) != NULL)
+		return;
+
+	new = ksymtab_copy_sym(ctx->symbols, ksym);
+	new->gen = ctx->gen;
+}
+
+static void ksymtab_add_and_link_alias(struct ksym *ksym, void *ctx)
+{
+	struct ksymtab *ksymtab = ctx;
+	char *link;
+	const char *name;
+	struct ksym *link_ksym;
+
+	link = ksymtab_ksym_get_link(ksym);
+	link_ksym = ksymtab_find(ksymtab, link);
+
+	/* if we linked, there must be the symbol in the symtab */
+	assert(link_ksym != NULL);
+
+	name = ksymtab_ksym_get_name(ksym);
+	ksymtab_ksym_set_link(link_ksym, name);
+
+	ksymtab_copy_sym(ksymtab, ksym);
+}
+
+static void merge_aliases(struct gen_job *job, struct ksymtab *symbols)
+{
+	struct alias_ctx ctx;
+
+	if (symbols == NULL)
+		return;
+
+	ctx.symbols = symbols;
+	ctx.gen = job->index;
+	ksymtab_for_each(job->aliases, ksymtab_add_alias, &ctx);
+}
+
+static walk_rv_t collect_symbol_file(char *path, void *arg)
+{
+	struct gen_jobs *jobs = arg;
+	generate_config_t *conf = jobs->conf;
+	struct gen_job *job;
+
+	/* We want to process only .ko kernel modules and vmlinux itself */
+	if (!safe_strendswith(path, ".ko") &&
+	    !safe_strendswith(path, "/vmlinux")) {
+		if (conf->kernel_dir) {
+			if (conf->verbose)
+				printf("Skip non-object file %s\n", path);
+			return WALK_CONT;
+		} else {
+			if (conf->verbose)
+				printf("Force processing file %s\n", path);
+		}
+	}
+
+	/*
+	 * Don't look into RHEL build cache directories.
+	 */
+	if (conf->rhel_tree) {
+		if (strstr(path, "redhat/rpm") != NULL)
+			return WALK_SKIP;
+	}
+
+	job = safe_zmalloc(sizeof(*job));
+	job->path = safe_strdup(path);
+	job->index = jobs->cnt;
+
+	jobs->jobs = safe_realloc(jobs->jobs,
+				  (jobs->cnt + 1) * sizeof(*jobs->jobs));
+	jobs->jobs[jobs->cnt++] = job;
+
+	return WALK_CONT;
+}
+
+static void job_free(struct gen_job *job)
+{
+	if (job->cu_dbs != NULL) {
+		/* Results of the jobs canceled before being folded */
+		list_free(job->cu_dbs);
+		list_free(job->records);
+		list_free(job->marks);
+		pthread_mutex_destroy(&job->lock);
+		pthread_cond_destroy(&job->cond);
+	}
+
+	ksymtab_free(job->aliases);
+	ksymtab_free(job->ksymtab);
+	free(job->cache_tmp);
+	free(job->cache_path);
+	free(job->build_id);
+	free(job->path);
+	free(job);
+}
+
+/* Read the exported symbols of the module */
+static void job_prepare(struct gen_job *job, generate_config_t *conf)
+{
+	struct elf_data *elf;
+
+	job->skip = true;
+
+	elf = elf_open(job->path);
+	if (elf == NULL) {
+		if (conf->verbose)
+			printf("Skip %s (unable to process ELF file)\n",
+			       job->path);
+		return;
+	}
+
+	if (elf_get_endianness(elf, &job->endianness) > 0)
+		goto clean_elf;
+
+	if (elf_get_exported(elf, &job->ksymtab, &job->aliases) > 0)
+		goto clean_elf;
+
+	/* Modules without a build-id are not cached */
+	if (conf->cache_dir != NULL)
+		elf_get_build_id(elf, &job->build_id);
+
+	if (ksymtab_len(job->ksymtab) == 0) {
+		if (conf->verbose)
+			printf("Skip %s (no exported symbols)\n", job->path);
+		goto clean_elf;
+	}
+
+	ksymtab_for_each(job->aliases, ksymtab_add_and_link_alias,
+			 job->ksymtab);
+	job->skip = false;
+clean_elf:
+	elf_close(elf);
+	free(elf->ehdr);
+	free(elf);
+}
+
+/*
+ * The cached records are only valid for the build of kabi-dw which
+ * generated them, so the cache params include a hash of the binary.
+ * Returns NULL if the binary can't be read.
+ */
+static char *cache_tool_stamp(void)
+{
+	uint64_t hash = FNV1A_64_INIT;
+	char buf[64 * 1024];
+	char *stamp;
+	size_t len;
+	bool ok;
+	FILE *f;
+
+	f = fopen("/proc/self/exe", "r");
+	if (f == NULL)
+		return NULL;
+
+	while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+		hash = fnv1a_64(hash, buf, len);
+
+	ok = !ferror(f);
+	fclose(f);
+	if (!ok)
+		return NULL;
+
+	safe_asprintf(&stamp, "%016" PRIx64, hash);
+	return stamp;
+}
+
+struct cache_params_ctx {
+	struct file_ctx *fctx;
+	FILE *f;
+};
+
+static void cache_params_symbol_cb(struct ksym *ksym, void *arg)
+{
+	struct cache_params_ctx *ctx = arg;
+	const char *name = ksymtab_ksym_get_name(ksym);
+
+	if (symbols_find(ctx->fctx, name) != NULL)
+		fprintf(ctx->f, " %s", name);
+}
+
+/*
+ * Everything besides the module itself which the records depend on.
+ * It's stored in the cache file and the file is used only if it matches.
+ */
+static char *job_cache_params(struct file_ctx *fctx)
+{
+	generate_config_t *conf = fctx->conf;
+	struct cache_params_ctx ctx;
+	char *params;
+	size_t len;
+
+	ctx.fctx = fctx;
+	ctx.f = open_memstream(&params, &len);
+	if (ctx.f == NULL)
+		fail("open_memstream() failed: %m\n");
+
+	fprintf(ctx.f, FILEFMT_VERSION_STRING);
+	fprintf(ctx.f, "tool %s\n", conf->tool_stamp);
+	fprintf(ctx.f, "extra %d\nabs-path %s\nendian %u\nsymbols",
+		conf->gen_extra,
+		get_file_replace_path ? get_file_replace_path : "",
+		fctx->job->endianness);
+	if (conf->symbols == NULL)
+		fprintf(ctx.f, " *");
+	else
+		ksymtab_for_each(fctx->job->ksymtab, cache_params_symbol_cb,
+				 &ctx);
+	fprintf(ctx.f, "\n");
+
+	if (fclose(ctx.f) != 0)
+		fail("fclose() failed: %m\n");
+
+	return params;
+}
+
+/* The params are part of the cache file name */
+static uint64_t cache_params_hash(const char *params)
+{
+	return fnv1a_64(FNV1A_64_INIT, params, strlen(params));
+}
+
+static void job_cache_create(struct gen_job *job, const char *params)
+{
+	job->cache = cache_create(job->cache_tmp, params);
+}
+
+static void job_cache_close(struct gen_job *job, generate_config_t *conf)
+{
+	cache_close(job->cache, job->cache_tmp);
+	job->cache = NULL;
+
+	/* The module wasn't processed completely */
+	if (generate_cancelled(conf)) {
+		unlink(job->cache_tmp);
+		return;
+	}
+
+	safe_rename(job->cache_tmp, job->cache_path);
+}
+
+static struct record *job_cache_decl_cb(const char *key, void *arg)
+{
+	struct file_ctx *fctx = arg;
+
+	return record_list_decl_dummy(record_db_lookup_or_init(fctx->conf->db,
+							       key));
+}
+
+static void *job_cache_mark_cb(const char *name, void *arg)
+{
+	struct file_ctx *fctx = arg;
+
+	if (fctx->conf->symbols == NULL)
+		return NULL;
+	return symbols_find(fctx, name);
+}
+
+/*
+ * Replay the results of the module from the cache file.
+ * Returns false if there is no usable cache file.
+ */
+static bool job_cache_load(struct file_ctx *fctx, const char *params)
+{
+	struct gen_job *job = fctx->job;
+	struct cache_resolver resolver;
+	struct cache_load load;
+	struct list_node *iter;
+	FILE *f;
+	bool ok;
+
+	f = fopen(job->cache_path, "r");
+	if (f == NULL)
+		return false;
+
+	resolver.decl = job_cache_decl_cb;
+	resolver.mark = job_cache_mark_cb;
+	resolver.arg = fctx;
+	cache_load_init(&load);
+	ok = cache_read(f, params, &resolver, &load);
+	fclose(f);
+
+	if (!ok) {
+		if (fctx->conf->verbose)
+			printf("Ignoring invalid cache file %s\n",
+			       job->cache_path);
+		return false;
+	}
+
+	LIST_FOR_EACH(&load.cu_dbs, iter)
+		job_add_cu(fctx, list_node_data(iter));
+	LIST_FOR_EACH(&load.records, iter)
+		job_add_record(fctx, list_node_data(iter));
+	LIST_FOR_EACH(&load.marks, iter)
+		job_mark(fctx, list_node_data(iter));
+	cache_load_clear(&load);
+
+	return true;
+}
+
+static void job_fctx_init(struct file_ctx *fctx, struct gen_job *job,
+			  generate_config_t *conf)
+{
+	fctx->conf = conf;
+	fctx->job = job;
+	fctx->cu = NULL;
+	fctx->ksymtab = job->ksymtab;
+	fctx->cu_filter = NULL;
+	fctx->elf_endian = job->endianness;
+}
+
+struct job_symbols_ctx {
+	struct file_ctx fctx;
+	bool found;
+};
+
+static void job_symbols_cb(struct ksym *ksym, void *arg)
+{
+	struct job_symbols_ctx *ctx = arg;
+
+	if (symbols_find(&ctx->fctx, ksymtab_ksym_get_name(ksym)) != NULL)
+		ctx->found = true;
+}
+
+/*
+ * Does the module export any of the requested symbols?
+ * If not, nothing would be generated from its debug info, so it's
+ * not worth opening it. Must be called after merging its aliases.
+ */
+static bool job_exports_symbols(struct gen_job *job, generate_config_t *conf)
+{
+	struct job_symbols_ctx ctx;
+
+	if (conf->symbols == NULL)
+		return true;
+
+	job_fctx_init(&ctx.fctx, job, conf);
+	ctx.found = false;
+	ksymtab_for_each(job->ksymtab, job_symbols_cb, &ctx);
+
+	return ctx.found;
+}
+
+/* Generate the records of the module from its debug info */
+static void job_generate(struct gen_job *job, generate_config_t *conf)
+{
+	struct file_ctx fctx;
+	char *params = NULL;
 
-	if (!link)
-		return false;
+	job_fctx_init(&fctx, job, conf);
 
 	if (conf->verbose)
-		printf("Generating weak record %s -> %s\n",
-		       key, link);
+		printf("Processing %s\n", job->path);
 
-	safe_asprintf(&name, "weak--%s", key);
+	if (job->build_id != NULL) {
+		params = job_cache_params(&fctx);
+		safe_asprintf(&job->cache_path, "%s/%s-%016" PRIx64,
+			      conf->cache_dir, job->build_id,
+			      cache_params_hash(params));
+		safe_asprintf(&job->cache_tmp, "%s.%d.%u", job->cache_path,
+			      getpid(), job->index);
 
-	rec = record_new_weak(name, link);
-	new_key = record_db_add(conf->db, rec);
+		if (job_cache_load(&fctx, params)) {
+			if (conf->verbose)
+				printf("Using cached records of %s\n",
+				       job->path);
+			free(params);
+			return;
+		}
 
-	record_put(rec);
-	free(name);
-	free(new_key);
+		job_cache_create(job, params);
+		free(params);
+	}
 
-	return true;
+	generate_type_info(job->path, &fctx);
+	ksymtab_for_each(job->ksymtab, process_not_found, &fctx);
+
+	if (job->cache != NULL)
+		job_cache_close(job, conf);
 }
 
-/*
- * process_not_found:
- *
- * Generate fake records for symbols, not found in the debug info,
- * but existed in the export list (most probably, assembly function).
- *
- * If there is a checklist, mark the symbol there (as processed).
- * If the symbol not in the checklist, ignore it completely,
- * means, do not mark and do not generate fake record for it either.
- */
-static void process_not_found(struct ksym *exported, void *ctx)
+/* Move the results of the job to the db, waiting for them as needed */
+static void job_fold(struct gen_job *job, generate_config_t *conf)
 {
-	generate_config_t *conf = ctx;
-	struct ksym *ksym;
-	const char *key = ksymtab_ksym_get_name(exported);
+	struct list cu_dbs;
+	struct list_node *iter;
+	bool done;
 
-	if (ksymtab_ksym_is_marked(exported))
-		return;
+	list_init(&cu_dbs, NULL);
 
-	if (conf->symbols) {
-		ksym = ksymtab_find(conf->symbols, key);
-		if (ksym == NULL)
-			return;
-		ksymtab_ksym_mark(ksym);
+	do {
+		pthread_mutex_lock(&job->lock);
+		while (list_len(job->cu_dbs) == 0 && !job->done)
+			pthread_cond_wait(&job->cond, &job->lock);
+		list_concat(&cu_dbs, job->cu_dbs);
+		done = job->done;
+		pthread_mutex_unlock(&job->lock);
+
+		LIST_FOR_EACH(&cu_dbs, iter) {
+			struct hash *cu_db = list_node_data(iter);
+
+			record_db_add_cu(conf->db, cu_db);
+			hash_free(cu_db);
+		}
+		list_clear(&cu_dbs);
+	} while (!done);
+
+	LIST_FOR_EACH(job->records, iter) {
+		struct record *rec = list_node_data(iter);
+
+		free(record_db_add(conf->db, rec));
 	}
+	list_clear(job->records);
 
-	if (!try_generate_alias(conf, exported))
-		generate_assembly_record(conf, key);
+	LIST_FOR_EACH(job->marks, iter)
+		ksymtab_ksym_mark(list_node_data(iter));
+	list_clear(job->marks);
 }
 
-static void ksymtab_add_alias(struct ksym *ksym, void *ctx)
+static void job_prepare_cb(size_t i, void *arg)
 {
-	struct ksymtab *ksymtab = ctx;
+	struct gen_jobs *jobs = arg;
 
-	ksymtab_copy_sym(ksymtab, ksym);
+	job_prepare(jobs->jobs[i], jobs->conf);
 }
 
-static void ksymtab_add_and_link_alias(struct ksym *ksym, void *ctx)
+static void job_generate_cb(size_t i, void *arg)
 {
-	struct ksymtab *ksymtab = ctx;
-	char *link;
-	const char *name;
-	struct ksym *link_ksym;
-
-	link = ksymtab_ksym_get_link(ksym);
-	link_ksym = ksymtab_find(ksymtab, link);
-
-	/* if we linked, there must be the symbol in the symtab */
-	assert(link_ksym != NULL);
+	struct gen_jobs *jobs = arg;
+	struct gen_job *job = jobs->jobs[i];
 
-	name = ksymtab_ksym_get_name(ksym);
-	ksymtab_ksym_set_link(link_ksym, name);
+	if (!job->skip && !generate_cancelled(jobs->conf))
+		job_generate(job, jobs->conf);
 
-	ksymtab_copy_sym(ksymtab, ksym);
+	pthread_mutex_lock(&job->lock);
+	job->done = true;
+	pthread_cond_signal(&job->cond);
+	pthread_mutex_unlock(&job->lock);
 }
 
-static void merge_aliases(struct ksymtab *ksymtab,
-			  struct ksymtab *symbols,
-			  struct ksymtab *aliases)
+static void generate_jobs_serial(struct gen_jobs *jobs)
 {
-	ksymtab_for_each(aliases, ksymtab_add_and_link_alias, ksymtab);
-	if (symbols != NULL)
-		ksymtab_for_each(aliases, ksymtab_add_alias, symbols);
-}
+	generate_config_t *conf = jobs->conf;
+	size_t i;
 
-static walk_rv_t process_symbol_file(char *path, void *arg)
-{
-	unsigned int endianness;
-	struct elf_data *elf;
-	struct file_ctx fctx;
-	generate_config_t *conf = (generate_config_t *)arg;
-	struct ksymtab *ksymtab;
-	struct ksymtab *aliases = NULL;
-	walk_rv_t ret = WALK_CONT;
+	for (i = 0; i < jobs->cnt; i++) {
+		struct gen_job *job = jobs->jobs[i];
 
-	/* We want to process only .ko kernel modules and vmlinux itself */
-	if (!safe_strendswith(path, ".ko") &&
-	    !safe_strendswith(path, "/vmlinux")) {
-		if (conf->kernel_dir) {
-			if (conf->verbose)
-				printf("Skip non-object file %s\n", path);
-			return ret;
-		} else {
+		jobs->last = i;
+
+		job_prepare(job, conf);
+		if (job->skip)
+			continue;
+
+		merge_aliases(job, conf->symbols);
+		if (!job_exports_symbols(job, conf)) {
 			if (conf->verbose)
-				printf("Force processing file %s\n", path);
+				printf("Skip %s (no requested symbols)\n",
+				       job->path);
+			continue;
 		}
-	}
 
-	/*
-	 * Don't look into RHEL build cache directories.
-	 */
-	if (conf->rhel_tree) {
-		if (strstr(path, "redhat/rpm") != NULL)
-			return WALK_SKIP;
-	}
+		job_generate(job, conf);
 
-	elf = elf_open(path);
-	if (elf == NULL) {
-		if (conf->verbose)
-			printf("Skip %s (unable to process ELF file)\n",
-			       path);
-		goto out;
+		if (is_all_done(conf))
+			break;
 	}
+}
 
-	if (elf_get_endianness(elf, &endianness) > 0)
-		goto clean_elf;
+/*
+ * The modules are read and processed by the worker threads, while the
+ * calling thread folds their results into the db in the walk order.
+ *
+ * The threads are split between the modules and their CUs, so that no
+ * more than conf->jobs of them run at once. Each module to generate gets
+ * its own thread as long as there are enough of them, the rest of the
+ * threads process the CUs of the modules.
+ */
+static void generate_jobs_parallel(struct gen_jobs *jobs)
+{
+	generate_config_t *conf = jobs->conf;
+	struct threadpool *pool;
+	unsigned int module_jobs;
+	size_t cnt = 0;
+	size_t i;
 
-	if (elf_get_exported(elf, &ksymtab, &aliases) > 0)
-		goto clean_elf;
+	pool = threadpool_start(conf->jobs, jobs->cnt, job_prepare_cb, jobs);
+	threadpool_join(pool);
 
-	if (ksymtab_len(ksymtab) == 0) {
-		if (conf->verbose)
-			printf("Skip %s (no exported symbols)\n", path);
-		goto clean_ksymtab;
+	for (i = 0; i < jobs->cnt; i++) {
+		struct gen_job *job = jobs->jobs[i];
+
+		pthread_mutex_init(&job->lock, NULL);
+		pthread_cond_init(&job->cond, NULL);
+		job->cu_dbs = list_new(cu_db_free);
+		job->records = list_new(list_record_free);
+		job->marks = list_new(NULL);
+
+		if (job->skip)
+			continue;
+
+		merge_aliases(job, conf->symbols);
+		if (!job_exports_symbols(job, conf)) {
+			if (conf->verbose)
+				printf("Skip %s (no requested symbols)\n",
+				       job->path);
+			job->skip = true;
+			continue;
+		}
+		cnt++;
 	}
 
-	merge_aliases(ksymtab, conf->symbols, aliases);
+	module_jobs = cnt > 0 && cnt < conf->jobs ? cnt : conf->jobs;
+	conf->cu_jobs = conf->jobs / module_jobs;
 
-	fctx.conf = conf;
-	fctx.ksymtab = ksymtab;
-	fctx.elf_endian = endianness;
+	pool = threadpool_start(module_jobs, jobs->cnt, job_generate_cb, jobs);
 
-	if (conf->verbose)
-		printf("Processing %s\n", path);
+	for (i = 0; i < jobs->cnt; i++) {
+		jobs->last = i;
 
-	generate_type_info(path, &fctx);
-	ksymtab_for_each(ksymtab, process_not_found, conf);
+		job_fold(jobs->jobs[i], conf);
 
-	if (is_all_done(conf))
-		ret = WALK_STOP;
-clean_ksymtab:
-	ksymtab_free(aliases);
-	ksymtab_free(ksymtab);
-clean_elf:
-	elf_close(elf);
-	free(elf->ehdr);
-	free(elf);
-out:
-	return ret;
+		if (is_all_done(conf)) {
+			__atomic_store_n(&conf->cancel, true, __ATOMIC_RELAXED);
+			threadpool_cancel(pool);
+			break;
+		}
+	}
+
+	threadpool_join(pool);
 }
 
 static void print_not_found(struct ksym *ksym, void *ctx)
 {
 	const char *s = ksymtab_ksym_get_name(ksym);
+	size_t *last = ctx;
+
+	/* Alias of a module which wasn't processed */
+	if (ksym->gen > *last)
+		return;
 
 	if (ksymtab_ksym_is_marked(ksym))
 		return;
 	printf("%s not found!\n", s);
 }
 
- /*
-  * Creates a string describing given record.
-  * The burden of freeing the string falls on the caller.
-  */
-static char *record_get_digest(struct record *rec)
-{
-
-	/*
-	 * TODO: this approach is far from perfect, there could be more
-	 * information about members as part of the key, but for now this works
-	 * good enough.
-	 */
-	char *key;
-	obj_t *obj = rec->obj;
-	const char *origin = rec->origin ? rec->origin : "";
-	int member_count = 0;
+struct digest_entry {
+	uint64_t digest;
+	size_t pos;
+	struct record *rec;
+};
 
-	if (!obj)
-		return safe_strdup(origin);
+struct digest_group {
+	size_t first; /* Position of the first record of the group */
+	struct record **records;
+	size_t cnt;
+};
 
-	if (obj->member_list) {
-		for (obj_list_t *member = obj->member_list->first;
-		     member != NULL;
-		     member = member->next) {
-			member_count++;
-		}
-	}
+static int digest_entry_cmp(const void *a, const void *b)
+{
+	const struct digest_entry *e1 = a;
+	const struct digest_entry *e2 = b;
 
-	safe_asprintf(&key,
-		      "%s.%zu.%zu.%zu.%zu.%zu.%i",
-		      origin,
-		      obj->alignment, obj->is_bitfield,
-		      obj->first_bit, obj->last_bit,
-		      obj->offset,
-		      member_count
-		);
+	if (e1->digest != e2->digest)
+		return e1->digest < e2->digest ? -1 : 1;
 
-	return key;
+	return (e1->pos > e2->pos) - (e1->pos < e2->pos);
 }
 
-struct digest_equivalence_list {
-	char *key;
-	struct list *records;
-};
-
-static void digest_equivalence_list_free(struct digest_equivalence_list *arg)
+static int digest_group_cmp(const void *a, const void *b)
 {
-	free(arg->key);
-	list_free(arg->records);
-	free(arg);
+	const struct digest_group *g1 = a;
+	const struct digest_group *g2 = b;
+
+	return (g1->first > g2->first) - (g1->first < g2->first);
 }
 
-static struct hash *split_record_list(struct list *input)
+/*
+ * Split the available records of the list into groups of the records with
+ * the same digest, ordered by their first records. The records stay in the
+ * list, the groups point to the array stored to recs. The merged records
+ * are released.
+ */
+static struct digest_group *split_record_list(struct ilist *input,
+					      struct record ***recs,
+					      size_t *cnt)
 {
-	struct hash *result
-		= hash_new(16, (void (*)(void *))digest_equivalence_list_free);
-	void *temp;
-	struct list_node *iter;
+	struct digest_entry *entries;
+	struct digest_group *groups;
+	struct digest_group *group = NULL;
+	struct ilist *iter;
+	struct ilist *tmp;
+	size_t len = ilist_len(input);
+	size_t n = 0;
+	size_t i;
 
-	LIST_FOR_EACH(input, iter) {
-		struct record *rec = list_node_data(iter);
-		char *key;
-		struct digest_equivalence_list *eq_list;
+	entries = safe_zmalloc((len + 1) * sizeof(*entries));
+	groups = safe_zmalloc((len + 1) * sizeof(*groups));
+	*recs = safe_zmalloc((len + 1) * sizeof(**recs));
+
+	ILIST_FOR_EACH_SAFE(input, iter, tmp) {
+		struct record *rec = record_entry(iter);
 
-		if (!record_list_node_is_available(iter))
+		if (!record_is_available(rec)) {
+			record_release(rec);
 			continue;
+		}
+
+		entries[n].digest = record_get_digest(rec);
+		entries[n].pos = n;
+		entries[n].rec = rec;
+		n++;
+	}
 
-		key = record_get_digest(rec);
-		eq_list = hash_find(result, key);
-		if (eq_list == NULL) {
-			eq_list = malloc(sizeof(*eq_list));
-			eq_list->key = key;
-			eq_list->records = list_new(NULL);
+	qsort(entries, n, sizeof(*entries), digest_entry_cmp);
 
-			hash_add(result, eq_list->key, eq_list);
-		} else {
-			free(key);
+	*cnt = 0;
+	for (i = 0; i < n; i++) {
+		if (i == 0 || entries[i].digest != entries[i - 1].digest) {
+			group = &groups[(*cnt)++];
+			group->first = entries[i].pos;
+			group->records = &(*recs)[i];
+			group->cnt = 0;
 		}
 
-		rec->list_node = list_add(eq_list->records, rec);
+		group->records[group->cnt++] = entries[i].rec;
 	}
 
-	/* clear the input list but do not free the data */
-	temp = input->free;
-	input->free = NULL;
-	list_clear(input);
-	input->free = temp;
+	qsort(groups, *cnt, sizeof(*groups), digest_group_cmp);
+	free(entries);
 
-	return result;
+	return groups;
 }
 
-static bool record_list_split_and_merge(struct record_list *rec_list)
+/*
+ * Merge the groups of the records with the same digest. left is set if
+ * some group could not be merged, and might be once other records are.
+ */
+static bool record_list_split_and_merge(struct record_list *rec_list,
+					bool *left)
 {
-	struct list *list = rec_list->records;
-	struct hash *split = split_record_list(list);
-	const void *val;
+	struct ilist *list = record_list_records(rec_list);
+	struct digest_group *groups;
+	struct record **recs;
 	bool merged = false;
-	struct hash_iter split_iter;
+	size_t cnt;
+	size_t i, j;
 
+	*left = false;
+	groups = split_record_list(list, &recs, &cnt);
 
-	/* try to merge digest_equivalence_lists */
-	hash_iter_init(split, &split_iter);
-	while (hash_iter_next(&split_iter, NULL, &val)) {
-		struct digest_equivalence_list *eq_list
-			= (struct digest_equivalence_list *)val;
-
-		if (list_len(eq_list->records) < 2) {
-			/* skipping lists with nothing to merge */
+	/* try to merge the groups */
+	for (i = 0; i < cnt; i++) {
+		if (groups[i].cnt < 2) {
+			/* skipping groups with nothing to merge */
 			continue;
 		}
 
-		if (record_merge_many(eq_list->records,
+		if (record_merge_many(groups[i].records, groups[i].cnt,
 				      MERGE_FLAG_VER_IGNORE |
 				      MERGE_FLAG_DECL_MERGE)) {
 			merged = true;
+		} else {
+			*left = true;
 		}
 	}
 
+	/* order the list by the groups */
+	for (i = 0; i < cnt; i++) {
+		for (j = 0; j < groups[i].cnt; j++) {
+			struct ilist *link = &groups[i].records[j]->list_node;
 
-	/* concat back together */
-	hash_iter_init(split, &split_iter);
-	while (hash_iter_next(&split_iter, NULL, &val)) {
-		struct digest_equivalence_list *eq_list
-			= (struct digest_equivalence_list *)val;
-
-		list_concat(list, eq_list->records);
+			ilist_del(link);
+			ilist_add_tail(list, link);
+		}
 	}
-
-	hash_free(split);
+	free(groups);
+	free(recs);
 
 	return merged;
 }
 
-bool record_db_merge_pairs(struct hash *hash)
+static bool record_lists_merge_pairs(struct record_list **lists, size_t cnt)
 {
-	struct hash_iter iter;
-	const void *val;
 	bool merged = false;
+	size_t i;
 
 	/*
 	 * Try to merge as pairs.
@@ -2472,26 +4225,24 @@ bool record_db_merge_pairs(struct hash *hash)
 	 * Should only be trying to merge them once, since trying more times
 	 * would be useless.
 	 */
-	hash_iter_init(hash, &iter);
-	while (hash_iter_next(&iter, NULL, &val)) {
-		struct record_list *rec_list
-			= (struct record_list *)val;
-		struct list_node *unsuc_iter;
-		struct list *con_list = record_list_records(rec_list);
+	for (i = 0; i < cnt; i++) {
+		struct record_list *rec_list = lists[i];
+		struct ilist *unsuc_iter;
+		struct ilist *con_list = record_list_records(rec_list);
 
-		LIST_FOR_EACH(con_list, unsuc_iter) {
-			struct record *unsuc = unsuc_iter->data;
-			struct list_node *con_iter;
+		ILIST_FOR_EACH(con_list, unsuc_iter) {
+			struct record *unsuc = record_entry(unsuc_iter);
+			struct ilist *con_iter;
 
-			if (unsuc == NULL)
+			if (!record_is_available(unsuc))
 				continue;
 
 			for (con_iter = unsuc_iter->next;
-			     con_iter != NULL;
+			     con_iter != con_list;
 			     con_iter = con_iter->next) {
-				struct record *con_rec = con_iter->data;
+				struct record *con_rec = record_entry(con_iter);
 
-				if (!record_list_node_is_available(con_iter))
+				if (!record_is_available(con_rec))
 					continue;
 
 				if (record_merge_pair(unsuc, con_rec))
@@ -2503,55 +4254,243 @@ bool record_db_merge_pairs(struct hash *hash)
 	return merged;
 }
 
-void record_db_merge(struct record_db *db)
+/*
+ * The keys whose records reference each other, directly or not. Merging
+ * only follows the references, so the components are merged separately.
+ */
+struct merge_component {
+	struct record_list **lists; /* In the order of the db */
+	size_t cnt;
+};
+
+struct merge_components {
+	struct merge_component *components;
+	size_t cnt;
+};
+
+struct merge_component_ctx {
+	size_t *parent;
+	size_t id;
+};
+
+static size_t merge_component_find(size_t *parent, size_t id)
+{
+	while (parent[id] != id) {
+		parent[id] = parent[parent[id]];
+		id = parent[id];
+	}
+
+	return id;
+}
+
+static int merge_component_add_cb(obj_t *o, void *arg)
 {
-	bool first = true;
+	struct merge_component_ctx *ctx = arg;
+	struct record_list *rec_list;
+	size_t a, b;
 
-	struct hash *hash = (struct hash *)db;
-	bool merged;
+	if (o->type != __type_reffile || o->ref_record == NULL)
+		return CB_CONT;
+
+	if (record_is_declaration(o->ref_record))
+		return CB_CONT;
+
+	rec_list = o->ref_record->rec_list;
+	if (rec_list == NULL)
+		return CB_CONT;
+
+	a = merge_component_find(ctx->parent, ctx->id);
+	b = merge_component_find(ctx->parent, rec_list->pos);
+	if (a < b)
+		ctx->parent[b] = a;
+	else
+		ctx->parent[a] = b;
+
+	return CB_CONT;
+}
+
+/* Bigger components first, so they don't end up running alone */
+static int merge_component_cmp(const void *a, const void *b)
+{
+	const struct merge_component *c1 = a;
+	const struct merge_component *c2 = b;
+
+	if (c1->cnt != c2->cnt)
+		return c1->cnt < c2->cnt ? 1 : -1;
+
+	return (c1->lists[0]->pos > c2->lists[0]->pos) -
+		(c1->lists[0]->pos < c2->lists[0]->pos);
+}
+
+static void merge_components_init(struct merge_components *comps,
+				  struct hash *hash)
+{
+	struct merge_component_ctx ctx;
+	struct record_list **lists;
 	struct hash_iter iter;
 	const void *val;
+	size_t *component;
+	size_t cnt = hash_get_count(hash);
+	size_t i = 0;
+
+	lists = safe_zmalloc((cnt + 1) * sizeof(*lists));
+	ctx.parent = safe_zmalloc((cnt + 1) * sizeof(*ctx.parent));
 
 	hash_iter_init(hash, &iter);
 	while (hash_iter_next(&iter, NULL, &val)) {
 		struct record_list *rec_list = (struct record_list *)val;
 
-		record_list_restore_postponed(rec_list);
+		rec_list->pos = i;
+		lists[i] = rec_list;
+		ctx.parent[i] = i;
+		i++;
 	}
 
-	do {
-		/* merge as groups */
+	for (i = 0; i < cnt; i++) {
+		struct ilist *iter;
+
+		ctx.id = i;
+		ILIST_FOR_EACH(record_list_records(lists[i]), iter) {
+			struct record *rec = record_entry(iter);
+
+			if (record_is_available(rec) && rec->obj != NULL)
+				obj_walk_tree(rec->obj, merge_component_add_cb,
+					      &ctx);
+		}
+	}
+
+	/* Number the components by their first key */
+	component = safe_zmalloc((cnt + 1) * sizeof(*component));
+	comps->components = safe_zmalloc((cnt + 1) *
+					 sizeof(*comps->components));
+	comps->cnt = 0;
+
+	for (i = 0; i < cnt; i++) {
+		size_t root = merge_component_find(ctx.parent, i);
+
+		if (root == i)
+			component[i] = comps->cnt++;
+		else
+			component[i] = component[root];
+		comps->components[component[i]].cnt++;
+	}
+
+	for (i = 0; i < comps->cnt; i++) {
+		struct merge_component *comp = &comps->components[i];
+
+		comp->lists = safe_zmalloc(comp->cnt * sizeof(*comp->lists));
+		comp->cnt = 0;
+	}
+
+	for (i = 0; i < cnt; i++) {
+		struct merge_component *comp
+			= &comps->components[component[i]];
+
+		comp->lists[comp->cnt++] = lists[i];
+	}
+
+	qsort(comps->components, comps->cnt, sizeof(*comps->components),
+	      merge_component_cmp);
+
+	free(component);
+	free(ctx.parent);
+	free(lists);
+}
+
+static void merge_components_free(struct merge_components *comps)
+{
+	size_t i;
+
+	for (i = 0; i < comps->cnt; i++)
+		free(comps->components[i].lists);
+	free(comps->components);
+}
+
+static void record_db_merge_component(struct merge_component *comp)
+{
+	struct list *pending;
+	struct list_node *pending_iter;
+	bool merged = false;
+	bool left;
+	size_t i;
+
+	/* merge as groups, remembering the keys with groups left to merge */
+	pending = list_new(NULL);
+
+	for (i = 0; i < comp->cnt; i++) {
+		if (record_list_split_and_merge(comp->lists[i], &left))
+			merged = true;
+		if (left)
+			list_add(pending, comp->lists[i]);
+	}
+
+	/* merge as pairs, once */
+	if (record_lists_merge_pairs(comp->lists, comp->cnt))
+		merged = true;
+
+	/*
+	 * The groups merge or not depending on the other records only, so
+	 * retry the groups left as long as some records were merged. The
+	 * groups never grow, there is nothing to do for the other keys.
+	 */
+	while (merged && list_len(pending) > 0) {
+		struct list *next = list_new(NULL);
+
 		merged = false;
 
-		hash_iter_init(hash, &iter);
-		while (hash_iter_next(&iter, NULL, &val)) {
+		LIST_FOR_EACH(pending, pending_iter) {
 			struct record_list *rec_list
-				= (struct record_list *)val;
-
-			if (rec_list == NULL)
-				continue;
+				= list_node_data(pending_iter);
 
-			if (record_list_split_and_merge(rec_list))
+			if (record_list_split_and_merge(rec_list, &left))
 				merged = true;
+			if (left)
+				list_add(next, rec_list);
 		}
 
+		list_free(pending);
+		pending = next;
+	}
+	list_free(pending);
+}
 
-		/* merge as pairs, once */
-		if (!first)
-			continue;
-		first = false;
+static void record_db_merge_component_cb(size_t i, void *arg)
+{
+	struct merge_components *comps = arg;
 
-		if (record_db_merge_pairs(hash))
-			merged = true;
+	record_db_merge_component(&comps->components[i]);
+}
 
-	} while (merged);
+/*
+ * The components don't share any record, so the result doesn't depend on
+ * the order they are merged in, nor does the order of the records of
+ * a key, which gives their versions.
+ */
+void record_db_merge(struct record_db *db, unsigned int jobs)
+{
+	struct merge_components comps;
+	struct threadpool *pool;
+	size_t i;
 
-	hash_iter_init(hash, &iter);
-	while (hash_iter_next(&iter, NULL, &val)) {
-		struct record_list *rec_list = (struct record_list *)val;
+	for (i = 0; i < db->cnt; i++)
+		record_list_restore_postponed(db->lists[i]);
+
+	merge_components_init(&comps, db->hash);
+
+	if (jobs > 1 && comps.cnt > 1) {
+		pool = threadpool_start(jobs, comps.cnt,
+					record_db_merge_component_cb, &comps);
+		threadpool_join(pool);
+	} else {
+		for (i = 0; i < comps.cnt; i++)
+			record_db_merge_component(&comps.components[i]);
+	}
+
+	merge_components_free(&comps);
 
-		record_list_clean_up(rec_list);
-		record_list_restore_postponed(rec_list);
+	for (i = 0; i < db->cnt; i++) {
+		record_list_clean_up(db->lists[i]);
+		record_list_restore_postponed(db->lists[i]);
 	}
 }
 
@@ -2562,6 +4501,8 @@ void record_db_merge(struct record_db *db)
 static void generate_symbol_defs(generate_config_t *conf)
 {
 	struct stat st;
+	struct gen_jobs jobs;
+	size_t i;
 
 	if (stat(conf->kernel_dir, &st) != 0)
 		fail("Failed to stat %s: %s\n", conf->kernel_dir,
@@ -2571,23 +4512,39 @@ static void generate_symbol_defs(generate_config_t *conf)
 	printf("Generating symbol defs from %s\n", conf->kernel_dir);
 
 	conf->db = record_db_init();
+	obj_shared_init();
+
+	jobs.conf = conf;
+	jobs.jobs = NULL;
+	jobs.cnt = 0;
+	jobs.last = 0;
 
 	if (S_ISDIR(st.st_mode)) {
-		walk_dir(conf->kernel_dir, false, process_symbol_file, conf);
+		walk_dir(conf->kernel_dir, false, collect_symbol_file, &jobs);
 	} else if (S_ISREG(st.st_mode)) {
 		char *path = conf->kernel_dir;
 		conf->kernel_dir = NULL;
-		process_symbol_file(path, conf);
+		collect_symbol_file(path, &jobs);
 	} else {
 		fail("Not a file or directory: %s\n", conf->kernel_dir);
 	}
 
-	ksymtab_for_each(conf->symbols, print_not_found, NULL);
+	if (conf->jobs > 1)
+		generate_jobs_parallel(&jobs);
+	else
+		generate_jobs_serial(&jobs);
+
+	for (i = 0; i < jobs.cnt; i++)
+		job_free(jobs.jobs[i]);
+	free(jobs.jobs);
 
-	record_db_merge(conf->db);
+	ksymtab_for_each(conf->symbols, print_not_found, &jobs.last);
+
+	record_db_merge(conf->db, conf->jobs);
 
 	record_db_dump(conf->db, conf->kabi_dir);
 	record_db_free(conf->db);
+	obj_shared_free();
 }
 
 #define	WHITESPACE	" \t\n"
@@ -2714,14 +4671,22 @@ static void generate_usage()
 	       "    -h, --help:\t\tshow this message\n"
 	       "    -v, --verbose:\tdisplay debug information\n"
 	       "    -o, --output kabi_dir:\n\t\t\t"
-	       "where to write kabi files (default: \"output\")\n"
+	       "where to write kabi files (default: \"output\"),\n"
+	       "\t\t\ta file ending with \"" KABIPACK_SUFFIX "\" to write"
+	       " a single kABI pack\n"
 	       "    -s, --symbols symbol_file:\n\t\t\ta file containing the"
 	       " list of symbols of interest (e.g. stablelisted)\n"
 	       "    -r, --rhel:\n\t\t\trun on the RHEL build tree\n"
 	       "    -a, --abs-path abs_path:\n\t\t\t"
 	       "replace the absolute path by a relative path\n"
 	       "    -g, --generate-extra-info:\n\t\t\t"
-	       "generate extra information (declaration stack, compilation unit)\n");
+	       "generate extra information (declaration stack, compilation unit)\n"
+	       "    -j, --jobs jobs:\n\t\t\t"
+	       "number of threads to use (default: 1)\n"
+	       "    -c, --cache-dir cache_dir:\n\t\t\t"
+	       "reuse the records of the modules generated by a previous run\n"
+	       "\t\t\tfrom the cache_dir, the modules are identified by\n"
+	       "\t\t\ttheir build-id\n");
 	exit(1);
 }
 
@@ -2732,7 +4697,10 @@ static void parse_generate_opts(int argc, char **argv, generate_config_t *conf,
 	conf->rhel_tree = false;
 	conf->verbose = false;
 	conf->kabi_dir = DEFAULT_OUTPUT_DIR;
+	conf->jobs = 1;
+	conf->cu_jobs = 1;
 	int opt, opt_index;
+	char *end;
 	struct option loptions[] = {
 		{"help", no_argument, 0, 'h'},
 		{"verbose", no_argument, 0, 'v'},
@@ -2741,10 +4709,12 @@ static void parse_generate_opts(int argc, char **argv, generate_config_t *conf,
 		{"rhel", no_argument, 0, 'r'},
 		{"abs-path", required_argument, 0, 'a'},
 		{"generate-extra-info", no_argument, 0, 'g'},
+		{"jobs", required_argument, 0, 'j'},
+		{"cache-dir", required_argument, 0, 'c'},
 		{0, 0, 0, 0}
 	};
 
-	while ((opt = getopt_long(argc, argv, "hvo:s:ra:m:g",
+	while ((opt = getopt_long(argc, argv, "hvo:s:ra:m:gj:c:",
 				  loptions, &opt_index)) != -1) {
 		switch (opt) {
 		case 'h':
@@ -2767,6 +4737,15 @@ static void parse_generate_opts(int argc, char **argv, generate_config_t *conf,
 		case 'g':
 			conf->gen_extra = true;
 			break;
+		case 'j':
+			errno = 0;
+			conf->jobs = strtoul(optarg, &end, 10);
+			if (errno != 0 || *end != '\0' || conf->jobs == 0)
+				fail("Invalid number of jobs: %s\n", optarg);
+			break;
+		case 'c':
+			conf->cache_dir = optarg;
+			break;
 		default:
 			generate_usage();
 		}
@@ -2777,7 +4756,18 @@ static void parse_generate_opts(int argc, char **argv, generate_config_t *conf,
 
 	conf->kernel_dir = argv[optind];
 
-	rec_mkdir(conf->kabi_dir);
+	if (!safe_strendswith(conf->kabi_dir, KABIPACK_SUFFIX))
+		rec_mkdir(conf->kabi_dir);
+	if (conf->cache_dir != NULL) {
+		conf->tool_stamp = cache_tool_stamp();
+		if (conf->tool_stamp == NULL) {
+			fprintf(stderr, "Warning: cannot read /proc/self/exe, "
+				"not using the cache\n");
+			conf->cache_dir = NULL;
+		} else {
+			rec_mkdir(conf->cache_dir);
+		}
+	}
 }
 
 void generate(int argc, char **argv)
@@ -2800,5 +4790,6 @@ void generate(int argc, char **argv)
 	if (symbol_file != NULL)
 		ksymtab_free(conf->symbols);
 
+	free(conf->tool_stamp);
 	free(conf);
 }
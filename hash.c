@@ -48,29 +48,30 @@ static inline unsigned int ALIGN_POWER2(unsigned int u)
 	return 1 << ((sizeof(u) * 8) - __builtin_clz(u - 1));
 }
 
-static inline size_t min(size_t a, size_t b)
-{
-	return a < b ? a : b;
-}
+/*
+ * Open addressing with linear probing and Robin Hood insertion, the full
+ * hash is stored with every entry so most of the probes don't have to look
+ * at the keys. The entries of a cluster are kept sorted by their home slot,
+ * and those with the same home slot by the hash and the key. The layout
+ * thus depends only on the keys and not on the order they were added in,
+ * which keeps the iteration order deterministic.
+ */
+
+#define	HASH_MIN_SIZE		8
+#define	HASH_MAX_INITIAL_SIZE	64
 
 struct hash_entry {
-	const char *key;
-	size_t keylen;
+	const char *key; /* NULL for an empty slot */
 	const void *value;
-};
-
-struct hash_bucket {
-	struct hash_entry *entries;
-	unsigned int used;
-	unsigned int total;
+	unsigned int keylen;
+	unsigned int hashval;
 };
 
 struct hash {
 	unsigned int count;
-	unsigned int step;
-	unsigned int n_buckets;
+	unsigned int size; /* Number of slots, a power of two */
 	void (*free_value)(void *value);
-	struct hash_bucket buckets[];
+	struct hash_entry *entries;
 };
 
 static inline int hash_key_cmp(const char *key1, size_t size1,
@@ -79,7 +80,7 @@ static inline int hash_key_cmp(const char *key1, size_t size1,
 	int rc;
 	size_t size;
 
-	size = min(size1, size2);
+	size = size1 < size2 ? size1 : size2;
 
 	rc = memcmp(key1, key2, size);
 	if (rc != 0)
@@ -88,45 +89,48 @@ static inline int hash_key_cmp(const char *key1, size_t size1,
 	return (int)(size1 - size2);
 }
 
-struct hash *hash_new(unsigned int n_buckets,
-					void (*free_value)(void *value))
+/*
+ * The size is only the initial one, the table grows as needed. The big
+ * guesses are capped, so the tables staying small don't waste memory.
+ */
+struct hash *hash_new(unsigned int size, void (*free_value)(void *value))
 {
 	struct hash *hash;
 
-	n_buckets = ALIGN_POWER2(n_buckets);
-	hash = calloc(1, sizeof(struct hash) +
-		      n_buckets * sizeof(struct hash_bucket));
+	if (size < HASH_MIN_SIZE)
+		size = HASH_MIN_SIZE;
+	else if (size > HASH_MAX_INITIAL_SIZE)
+		size = HASH_MAX_INITIAL_SIZE;
+
+	hash = calloc(1, sizeof(struct hash));
 	if (hash == NULL)
 		return NULL;
-	hash->n_buckets = n_buckets;
+	hash->size = ALIGN_POWER2(size);
 	hash->free_value = free_value;
-	hash->step = n_buckets / 32;
-	if (hash->step == 0)
-		hash->step = 4;
-	else if (hash->step > 64)
-		hash->step = 64;
+	hash->entries = calloc(hash->size, sizeof(struct hash_entry));
+	if (hash->entries == NULL) {
+		free(hash);
+		return NULL;
+	}
 	return hash;
 }
 
 void hash_free(struct hash *hash)
 {
-	struct hash_bucket *bucket, *bucket_end;
+	struct hash_entry *entry, *entry_end;
 
 	if (hash == NULL)
 		return;
 
-	bucket = hash->buckets;
-	bucket_end = bucket + hash->n_buckets;
-	for (; bucket < bucket_end; bucket++) {
-		if (hash->free_value) {
-			struct hash_entry *entry, *entry_end;
-			entry = bucket->entries;
-			entry_end = entry + bucket->used;
-			for (; entry < entry_end; entry++)
+	if (hash->free_value) {
+		entry = hash->entries;
+		entry_end = entry + hash->size;
+		for (; entry < entry_end; entry++) {
+			if (entry->key != NULL)
 				hash->free_value((void *)entry->value);
 		}
-		free(bucket->entries);
 	}
+	free(hash->entries);
 	free(hash);
 }
 
@@ -181,6 +185,118 @@ static inline unsigned int hash_superfast(const char *key, unsigned int len)
 	return hash;
 }
 
+/* Distance of the entry in the slot from its home slot */
+static inline unsigned int hash_dist(const struct hash *hash,
+				     const struct hash_entry *entry,
+				     unsigned int slot)
+{
+	return (slot - entry->hashval) & (hash->size - 1);
+}
+
+/* Order of the entries with the same home slot */
+static inline int hash_entry_order(const struct hash_entry *a,
+				   const struct hash_entry *b)
+{
+	if (a->hashval != b->hashval)
+		return a->hashval < b->hashval ? -1 : 1;
+
+	return hash_key_cmp(a->key, a->keylen, b->key, b->keylen);
+}
+
+static struct hash_entry *hash_lookup(const struct hash *hash,
+				      unsigned int hashval,
+				      const char *key, size_t keylen)
+{
+	unsigned int mask = hash->size - 1;
+	unsigned int slot = hashval & mask;
+	unsigned int dist;
+
+	for (dist = 0; ; dist++, slot = (slot + 1) & mask) {
+		struct hash_entry *entry = hash->entries + slot;
+
+		/* The key would have displaced the entry */
+		if (entry->key == NULL || hash_dist(hash, entry, slot) < dist)
+			return NULL;
+
+		if (entry->hashval == hashval && entry->keylen == keylen &&
+		    memcmp(entry->key, key, keylen) == 0)
+			return entry;
+	}
+}
+
+/* Put the entry, whose key is not in the table, to its place */
+static void hash_insert(struct hash *hash, struct hash_entry entry)
+{
+	unsigned int mask = hash->size - 1;
+	unsigned int slot = entry.hashval & mask;
+	unsigned int dist;
+
+	for (dist = 0; ; dist++, slot = (slot + 1) & mask) {
+		struct hash_entry *cur = hash->entries + slot;
+		unsigned int cur_dist;
+
+		if (cur->key == NULL) {
+			*cur = entry;
+			return;
+		}
+
+		cur_dist = hash_dist(hash, cur, slot);
+		if (cur_dist < dist ||
+		    (cur_dist == dist && hash_entry_order(&entry, cur) < 0)) {
+			struct hash_entry tmp = *cur;
+
+			*cur = entry;
+			entry = tmp;
+			dist = cur_dist;
+		}
+	}
+}
+
+static int hash_grow(struct hash *hash)
+{
+	struct hash_entry *old = hash->entries;
+	unsigned int old_size = hash->size;
+	unsigned int i;
+
+	hash->entries = calloc(old_size * 2, sizeof(struct hash_entry));
+	if (hash->entries == NULL) {
+		hash->entries = old;
+		return -ENOMEM;
+	}
+	hash->size = old_size * 2;
+
+	for (i = 0; i < old_size; i++) {
+		if (old[i].key != NULL)
+			hash_insert(hash, old[i]);
+	}
+	free(old);
+
+	return 0;
+}
+
+static int hash_add_entry(struct hash *hash, unsigned int hashval,
+			  const char *key, size_t keylen, const void *value)
+{
+	struct hash_entry entry = {
+		.key = key,
+		.value = value,
+		.keylen = keylen,
+		.hashval = hashval,
+	};
+
+	/* Keep the load under 3/4 */
+	if ((hash->count + 1) * 4 > hash->size * 3) {
+		int rc = hash_grow(hash);
+
+		if (rc < 0)
+			return rc;
+	}
+
+	hash_insert(hash, entry);
+	hash->count++;
+	return 0;
+}
+
 /*
  * add or replace key in hash map.
  *
@@ -191,44 +307,18 @@ int hash_add_bin(struct hash *hash,
 		 const char *key, size_t keylen, const void *value)
 {
 	unsigned int hashval = hash_superfast(key, keylen);
-	unsigned int pos = hashval & (hash->n_buckets - 1);
-	struct hash_bucket *bucket = hash->buckets + pos;
-	struct hash_entry *entry, *entry_end;
-
-	if (bucket->used + 1 >= bucket->total) {
-		unsigned new_total = bucket->total + hash->step;
-		size_t size = new_total * sizeof(struct hash_entry);
-		struct hash_entry *tmp = realloc(bucket->entries, size);
-		if (tmp == NULL)
-			return -errno;
-		bucket->entries = tmp;
-		bucket->total = new_total;
+	struct hash_entry *entry;
+
+	entry = hash_lookup(hash, hashval, key, keylen);
+	if (entry != NULL) {
+		if (hash->free_value)
+			hash->free_value((void *)entry->value);
+		entry->key = key;
+		entry->value = value;
+		return 0;
 	}
 
-	entry = bucket->entries;
-	entry_end = entry + bucket->used;
-	for (; entry < entry_end; entry++) {
-		int c = hash_key_cmp(key, keylen, entry->key, entry->keylen);
-		if (c == 0) {
-			if (hash->free_value)
-				hash->free_value((void *)entry->value);
-			entry->key = key;
-			entry->keylen = keylen;
-			entry->value = value;
-			return 0;
-		} else if (c < 0) {
-			memmove(entry + 1, entry,
-				(entry_end - entry) * sizeof(struct hash_entry));
-			break;
-		}
-	}
-
-	entry->key = key;
-	entry->keylen = keylen;
-	entry->value = value;
-	bucket->used++;
-	hash->count++;
-	return 0;
+	return hash_add_entry(hash, hashval, key, keylen, value);
 }
 
 /* similar to hash_add(), but fails if key already exists */
@@ -236,61 +326,19 @@ int hash_add_unique_bin(struct hash *hash,
 			const char *key, size_t keylen, const void *value)
 {
 	unsigned int hashval = hash_superfast(key, keylen);
-	unsigned int pos = hashval & (hash->n_buckets - 1);
-	struct hash_bucket *bucket = hash->buckets + pos;
-	struct hash_entry *entry, *entry_end;
-
-	if (bucket->used + 1 >= bucket->total) {
-		unsigned new_total = bucket->total + hash->step;
-		size_t size = new_total * sizeof(struct hash_entry);
-		struct hash_entry *tmp = realloc(bucket->entries, size);
-		if (tmp == NULL)
-			return -errno;
-		bucket->entries = tmp;
-		bucket->total = new_total;
-	}
-
-	entry = bucket->entries;
-	entry_end = entry + bucket->used;
-	for (; entry < entry_end; entry++) {
-		int c = hash_key_cmp(key, keylen, entry->key, entry->keylen);
-		if (c == 0)
-			return -EEXIST;
-		else if (c < 0) {
-			memmove(entry + 1, entry,
-				(entry_end - entry) * sizeof(struct hash_entry));
-			break;
-		}
-	}
 
-	entry->key = key;
-	entry->keylen = keylen;
-	entry->value = value;
-	bucket->used++;
-	hash->count++;
-	return 0;
-}
+	if (hash_lookup(hash, hashval, key, keylen) != NULL)
+		return -EEXIST;
 
-static int hash_entry_cmp(const void *pa, const void *pb)
-{
-	const struct hash_entry *a = pa;
-	const struct hash_entry *b = pb;
-	return hash_key_cmp(a->key, a->keylen, b->key, b->keylen);
+	return hash_add_entry(hash, hashval, key, keylen, value);
 }
 
 void *hash_find_bin(const struct hash *hash, const char *key, size_t keylen)
 {
 	unsigned int hashval = hash_superfast(key, keylen);
-	unsigned int pos = hashval & (hash->n_buckets - 1);
-	const struct hash_bucket *bucket = hash->buckets + pos;
-	const struct hash_entry se = {
-		.key = key,
-		.keylen = keylen,
-		.value = NULL
-	};
-	const struct hash_entry *entry = bsearch(
-		&se, bucket->entries, bucket->used,
-		sizeof(struct hash_entry), hash_entry_cmp);
+	const struct hash_entry *entry;
+
+	entry = hash_lookup(hash, hashval, key, keylen);
 	if (entry == NULL)
 		return NULL;
 	return (void *)entry->value;
@@ -299,42 +347,31 @@ void *hash_find_bin(const struct hash *hash, const char *key, size_t keylen)
 int hash_del_bin(struct hash *hash, const char *key, size_t keylen)
 {
 	unsigned int hashval = hash_superfast(key, keylen);
-	unsigned int pos = hashval & (hash->n_buckets - 1);
-	unsigned int steps_used, steps_total;
-	struct hash_bucket *bucket = hash->buckets + pos;
-	struct hash_entry *entry, *entry_end;
-	const struct hash_entry se = {
-		.key = key,
-		.keylen = keylen,
-		.value = NULL
-	};
+	unsigned int mask = hash->size - 1;
+	struct hash_entry *entry;
+	unsigned int slot;
 
-	entry = bsearch(&se, bucket->entries, bucket->used,
-		sizeof(struct hash_entry), hash_entry_cmp);
+	entry = hash_lookup(hash, hashval, key, keylen);
 	if (entry == NULL)
 		return -ENOENT;
 
 	if (hash->free_value)
 		hash->free_value((void *)entry->value);
 
-	entry_end = bucket->entries + bucket->used;
-	memmove(entry, entry + 1,
-		(entry_end - entry) * sizeof(struct hash_entry));
+	/* Shift the rest of the cluster back, it stays sorted */
+	slot = entry - hash->entries;
+	for (;;) {
+		unsigned int next = (slot + 1) & mask;
+		struct hash_entry *cur = hash->entries + next;
 
-	bucket->used--;
-	hash->count--;
+		if (cur->key == NULL || hash_dist(hash, cur, next) == 0)
+			break;
 
-	steps_used = bucket->used / hash->step;
-	steps_total = bucket->total / hash->step;
-	if (steps_used + 1 < steps_total) {
-		size_t size = (steps_used + 1) *
-			hash->step * sizeof(struct hash_entry);
-		struct hash_entry *tmp = realloc(bucket->entries, size);
-		if (tmp) {
-			bucket->entries = tmp;
-			bucket->total = (steps_used + 1) * hash->step;
-		}
+		hash->entries[slot] = *cur;
+		slot = next;
 	}
+	memset(hash->entries + slot, 0, sizeof(struct hash_entry));
+	hash->count--;
 
 	return 0;
 }
@@ -347,35 +384,25 @@ unsigned int hash_get_count(const struct hash *hash)
 void hash_iter_init(const struct hash *hash, struct hash_iter *iter)
 {
 	iter->hash = hash;
-	iter->bucket = 0;
-	iter->entry = -1;
+	iter->slot = 0;
 }
 
 bool hash_iter_next_bin(struct hash_iter *iter, const char **key,
 			size_t *keylen,
 			const void **value)
 {
-	const struct hash_bucket *b = iter->hash->buckets + iter->bucket;
+	const struct hash *hash = iter->hash;
 	const struct hash_entry *e;
 
-	iter->entry++;
-
-	if (iter->entry >= b->used) {
-		iter->entry = 0;
-
-		for (iter->bucket++; iter->bucket < iter->hash->n_buckets;
-							iter->bucket++) {
-			b = iter->hash->buckets + iter->bucket;
-
-			if (b->used > 0)
-				break;
-		}
-
-		if (iter->bucket >= iter->hash->n_buckets)
-			return false;
+	for (; iter->slot < hash->size; iter->slot++) {
+		if (hash->entries[iter->slot].key != NULL)
+			break;
 	}
 
-	e = b->entries + iter->entry;
+	if (iter->slot >= hash->size)
+		return false;
+
+	e = hash->entries + iter->slot++;
 
 	if (value != NULL)
 		*value = e->value;
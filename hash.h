@@ -7,11 +7,10 @@ struct hash;
 
 struct hash_iter {
 	const struct hash *hash;
-	unsigned int bucket;
-	unsigned int entry;
+	unsigned int slot;
 };
 
-struct hash *hash_new(unsigned int n_buckets, void (*free_value)(void *value));
+struct hash *hash_new(unsigned int size, void (*free_value)(void *value));
 void hash_free(struct hash *hash);
 int hash_add_bin(struct hash *hash,
 		 const char *key, size_t keylen, const void *value);
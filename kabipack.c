@@ -0,0 +1,404 @@
+/*
+	Copyright(C) 2016, Red Hat, Inc., Stanislav Kozina
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * The pack layout, all the numbers are little endian:
+ *
+ * header:	struct kabipack_header
+ * data:	the content of the kABI files, one after another
+ * names:	the NUL terminated names of the files
+ * index:	struct kabipack_entry for every file, sorted by name
+ *
+ * The names are the paths the files would have in the kABI directory,
+ * so a pack can be unpacked to exactly the tree generate would write.
+ */
+
+#include <endian.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+#include "kabipack.h"
+
+#define	KABIPACK_MAGIC		"KABIPACK"
+#define	KABIPACK_VERSION	1
+
+struct kabipack_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+	uint64_t count;
+	uint64_t index_off;
+	uint64_t names_off;
+	uint64_t names_size;
+};
+
+struct kabipack_entry {
+	uint64_t name_off; /* Relative to the names */
+	uint64_t data_off;
+	uint64_t data_size;
+};
+
+struct kabipack_file {
+	char *name;
+	uint64_t data_off;
+	uint64_t data_size;
+};
+
+struct kabipack_writer {
+	char *path;
+	FILE *f;
+	uint64_t off;
+	struct kabipack_file *files;
+	size_t cnt;
+	size_t size;
+};
+
+struct kabipack {
+	const char *map;
+	size_t size;
+	size_t count;
+	const struct kabipack_entry *index;
+	const char *names;
+};
+
+static void kabipack_write(struct kabipack_writer *w, const void *data,
+			   size_t size)
+{
+	if (size > 0 && fwrite(data, size, 1, w->f) != 1)
+		fail("Cannot write kABI pack '%s': %m\n", w->path);
+	w->off += size;
+}
+
+struct kabipack_writer *kabipack_create(const char *path)
+{
+	struct kabipack_writer *w = safe_zmalloc(sizeof(*w));
+	struct kabipack_header header;
+
+	w->path = safe_strdup(path);
+	w->f = fopen(path, "w");
+	if (w->f == NULL)
+		fail("Cannot create kABI pack '%s': %m\n", path);
+
+	/* Written again once the layout is known */
+	memset(&header, 0, sizeof(header));
+	kabipack_write(w, &header, sizeof(header));
+
+	return w;
+}
+
+void kabipack_add(struct kabipack_writer *w, const char *name,
+		  const void *data, size_t size)
+{
+	struct kabipack_file *file;
+
+	if (w->cnt == w->size) {
+		w->size = w->size ? w->size * 2 : 1024;
+		w->files = safe_realloc(w->files,
+					w->size * sizeof(*w->files));
+	}
+
+	file = &w->files[w->cnt++];
+	file->name = safe_strdup(name);
+	file->data_off = w->off;
+	file->data_size = size;
+
+	kabipack_write(w, data, size);
+}
+
+static int kabipack_file_cmp(const void *a, const void *b)
+{
+	const struct kabipack_file *f1 = a;
+	const struct kabipack_file *f2 = b;
+
+	return strcmp(f1->name, f2->name);
+}
+
+void kabipack_close(struct kabipack_writer *w)
+{
+	struct kabipack_header header;
+	struct kabipack_entry entry;
+	uint64_t names_off = w->off;
+	uint64_t name_off = 0;
+	uint64_t pad = 0;
+	size_t i;
+
+	qsort(w->files, w->cnt, sizeof(*w->files), kabipack_file_cmp);
+
+	for (i = 0; i < w->cnt; i++)
+		kabipack_write(w, w->files[i].name,
+			       strlen(w->files[i].name) + 1);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, KABIPACK_MAGIC, sizeof(header.magic));
+	header.version = htole32(KABIPACK_VERSION);
+	header.count = htole64(w->cnt);
+	header.names_off = htole64(names_off);
+	header.names_size = htole64(w->off - names_off);
+
+	/* Keep the index aligned for the readers */
+	kabipack_write(w, &pad, -w->off & (sizeof(pad) - 1));
+	header.index_off = htole64(w->off);
+
+	for (i = 0; i < w->cnt; i++) {
+		entry.name_off = htole64(name_off);
+		entry.data_off = htole64(w->files[i].data_off);
+		entry.data_size = htole64(w->files[i].data_size);
+		kabipack_write(w, &entry, sizeof(entry));
+
+		name_off += strlen(w->files[i].name) + 1;
+		free(w->files[i].name);
+	}
+
+	if (fseek(w->f, 0, SEEK_SET) != 0)
+		fail("Cannot seek in kABI pack '%s': %m\n", w->path);
+	kabipack_write(w, &header, sizeof(header));
+
+	if (fclose(w->f) != 0)
+		fail("Cannot write kABI pack '%s': %m\n", w->path);
+
+	free(w->files);
+	free(w->path);
+	free(w);
+}
+
+/* Check the pack, so the accessors don't need to */
+static bool kabipack_valid(struct kabipack *pack,
+			   const struct kabipack_header *header)
+{
+	uint64_t index_off = le64toh(header->index_off);
+	uint64_t names_off = le64toh(header->names_off);
+	uint64_t names_size = le64toh(header->names_size);
+	uint64_t count = le64toh(header->count);
+	size_t i;
+
+	if (le32toh(header->version) != KABIPACK_VERSION)
+		return false;
+
+	if (names_off > pack->size || names_size > pack->size - names_off)
+		return false;
+	if (names_size > 0 && pack->map[names_off + names_size - 1] != '\0')
+		return false;
+
+	if (index_off > pack->size || index_off % sizeof(uint64_t) != 0 ||
+	    count > (pack->size - index_off) / sizeof(*pack->index))
+		return false;
+
+	pack->count = count;
+	pack->index = (const struct kabipack_entry *)(pack->map + index_off);
+	pack->names = pack->map + names_off;
+
+	for (i = 0; i < pack->count; i++) {
+		const struct kabipack_entry *e = &pack->index[i];
+		uint64_t data_off = le64toh(e->data_off);
+		uint64_t data_size = le64toh(e->data_size);
+
+		if (le64toh(e->name_off) >= names_size)
+			return false;
+		if (data_off > pack->size || data_size > pack->size - data_off)
+			return false;
+		if (i > 0 && strcmp(kabipack_name(pack, i - 1),
+				    kabipack_name(pack, i)) >= 0)
+			return false;
+	}
+
+	return true;
+}
+
+struct kabipack *kabipack_open(const char *path)
+{
+	struct kabipack_header header;
+	struct kabipack *pack;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		fail("Cannot open '%s': %m\n", path);
+
+	if (fstat(fd, &st) != 0)
+		fail("Cannot stat '%s': %m\n", path);
+
+	if (!S_ISREG(st.st_mode) || (size_t)st.st_size < sizeof(header) ||
+	    pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+	    memcmp(header.magic, KABIPACK_MAGIC, sizeof(header.magic)) != 0) {
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		fail("Cannot mmap '%s': %m\n", path);
+	close(fd);
+
+	pack = safe_zmalloc(sizeof(*pack));
+	pack->map = map;
+	pack->size = st.st_size;
+
+	if (!kabipack_valid(pack, &header))
+		fail("Corrupted kABI pack '%s'\n", path);
+
+	return pack;
+}
+
+void kabipack_free(struct kabipack *pack)
+{
+	munmap((void *)pack->map, pack->size);
+	free(pack);
+}
+
+size_t kabipack_count(struct kabipack *pack)
+{
+	return pack->count;
+}
+
+const char *kabipack_name(struct kabipack *pack, size_t i)
+{
+	return pack->names + le64toh(pack->index[i].name_off);
+}
+
+const char *kabipack_data(struct kabipack *pack, size_t i, size_t *size)
+{
+	*size = le64toh(pack->index[i].data_size);
+	return pack->map + le64toh(pack->index[i].data_off);
+}
+
+ssize_t kabipack_find(struct kabipack *pack, const char *name)
+{
+	size_t lo = 0, hi = pack->count;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int cmp = strcmp(name, kabipack_name(pack, mid));
+
+		if (cmp == 0)
+			return mid;
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	return -1;
+}
+
+/* Open the file for reading, so it can be handed to the parser */
+FILE *kabipack_fopen(struct kabipack *pack, size_t i)
+{
+	const char *data;
+	size_t size;
+	FILE *f;
+
+	data = kabipack_data(pack, i, &size);
+	f = fmemopen((void *)data, size, "r");
+	if (f == NULL)
+		fail("Failed to open kABI file: %s\n", kabipack_name(pack, i));
+
+	return f;
+}
+
+static void unpack_usage()
+{
+	printf("Usage:\n"
+	       "\tunpack [options] kabi_pack kabi_dir\n"
+	       "\nOptions:\n"
+	       "    -h, --help:\t\tshow this message\n");
+	exit(1);
+}
+
+static void unpack_file(struct kabipack *pack, size_t i, const char *dir)
+{
+	const char *name = kabipack_name(pack, i);
+	const char *data;
+	char *path;
+	char *slash;
+	size_t size;
+	FILE *f;
+
+	/* Don't let the pack write outside of the directory */
+	if (name[0] == '/' || strcmp(name, "..") == 0 ||
+	    strncmp(name, "../", 3) == 0 || strstr(name, "/../") != NULL ||
+	    safe_strendswith(name, "/.."))
+		fail("Invalid kABI file name in the pack: %s\n", name);
+
+	safe_asprintf(&path, "%s/%s", dir, name);
+
+	slash = strrchr(path, '/');
+	*slash = '\0';
+	rec_mkdir(path);
+	*slash = '/';
+
+	f = fopen(path, "w");
+	if (f == NULL)
+		fail("Cannot create record file '%s': %m", path);
+
+	data = kabipack_data(pack, i, &size);
+	if (size > 0 && fwrite(data, size, 1, f) != 1)
+		fail("Cannot write record file '%s': %m", path);
+
+	if (fclose(f) != 0)
+		fail("Cannot write record file '%s': %m", path);
+	free(path);
+}
+
+/*
+ * Performs the unpack command
+ */
+int unpack(int argc, char **argv)
+{
+	struct kabipack *pack;
+	char *pack_path, *dir;
+	int opt, opt_index;
+	size_t i;
+	struct option loptions[] = {
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	while ((opt = getopt_long(argc, argv, "h",
+				  loptions, &opt_index)) != -1) {
+		switch (opt) {
+		case 'h':
+		default:
+			unpack_usage();
+		}
+	}
+
+	if (optind != argc - 2)
+		unpack_usage();
+
+	pack_path = argv[optind++];
+	dir = argv[optind++];
+
+	pack = kabipack_open(pack_path);
+	if (pack == NULL)
+		fail("Not a kABI pack: %s\n", pack_path);
+
+	rec_mkdir(dir);
+	for (i = 0; i < kabipack_count(pack); i++)
+		unpack_file(pack, i, dir);
+
+	kabipack_free(pack);
+
+	return 0;
+}
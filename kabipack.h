@@ -0,0 +1,52 @@
+/*
+	Copyright(C) 2016, Red Hat, Inc., Stanislav Kozina
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Single file kABI pack: all the kABI files of a generate run with a
+ * sorted index, meant to be mmap'ed by compare and show.
+ */
+
+#ifndef KABIPACK_H_
+#define	KABIPACK_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define	KABIPACK_SUFFIX	".kabipack"
+
+struct kabipack_writer;
+struct kabipack;
+
+extern struct kabipack_writer *kabipack_create(const char *path);
+extern void kabipack_add(struct kabipack_writer *, const char *name,
+			 const void *data, size_t size);
+extern void kabipack_close(struct kabipack_writer *);
+
+/* Returns NULL if the file is not a kABI pack */
+extern struct kabipack *kabipack_open(const char *path);
+extern void kabipack_free(struct kabipack *);
+extern size_t kabipack_count(struct kabipack *);
+extern const char *kabipack_name(struct kabipack *, size_t);
+extern const char *kabipack_data(struct kabipack *, size_t, size_t *size);
+/* Returns the index of the file or -1 if it's not in the pack */
+extern ssize_t kabipack_find(struct kabipack *, const char *name);
+extern FILE *kabipack_fopen(struct kabipack *, size_t);
+
+int unpack(int argc, char **argv);
+
+#endif /* KABIPACK_H_ */
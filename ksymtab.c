@@ -49,10 +49,20 @@
 
 #define KSYMTAB_SIZE 8192
 
+/*
+ * Bloom filter of the names in the table, all the bits of a name are in a
+ * single word. The filter is rebuilt twice as big when the table has more
+ * than KSYMTAB_FILTER_LOAD names per word.
+ */
+#define KSYMTAB_FILTER_SIZE 64 /* Initial number of words */
+#define KSYMTAB_FILTER_LOAD 4
+
 struct ksymtab {
 	struct hash *hash;
 	size_t mark_count;
 	Elf64_Addr addr;
+	uint64_t *filter;
+	size_t filter_size; /* Power of two */
 };
 
 struct ksym;
@@ -248,6 +258,60 @@ static inline void elf_for_each_global_sym(struct elf_data *ed,
 	return elf_for_each_sym(ed, fn, ctx, elf_iter_global_weak);
 }
 
+uint64_t ksymtab_filter_hash(const char *name)
+{
+	uint64_t hash = fnv1a_64(FNV1A_64_INIT, name, strlen(name));
+
+	/* Mix the bits for the filter positions */
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdull;
+	hash ^= hash >> 33;
+
+	return hash;
+}
+
+static inline uint64_t ksymtab_filter_mask(uint64_t hash)
+{
+	return 1ull << (hash >> 40 & 63) | 1ull << (hash >> 46 & 63) |
+	       1ull << (hash >> 52 & 63) | 1ull << (hash >> 58);
+}
+
+static inline uint64_t *ksymtab_filter_word(struct ksymtab *ksymtab,
+					    uint64_t hash)
+{
+	return &ksymtab->filter[hash & (ksymtab->filter_size - 1)];
+}
+
+static void ksymtab_filter_grow(struct ksymtab *ksymtab)
+{
+	struct hash_iter iter;
+	const char *key;
+
+	ksymtab->filter_size *= 2;
+	free(ksymtab->filter);
+	ksymtab->filter = safe_zmalloc(ksymtab->filter_size *
+				       sizeof(*ksymtab->filter));
+
+	hash_iter_init(ksymtab->hash, &iter);
+	while (hash_iter_next(&iter, &key, NULL)) {
+		uint64_t hash = ksymtab_filter_hash(key);
+
+		*ksymtab_filter_word(ksymtab, hash) |=
+			ksymtab_filter_mask(hash);
+	}
+}
+
+/*
+ * Returns false if the name with the given ksymtab_filter_hash() is
+ * not in the table. True means the name is likely there.
+ */
+bool ksymtab_filter_test(struct ksymtab *ksymtab, uint64_t hash)
+{
+	uint64_t mask = ksymtab_filter_mask(hash);
+
+	return (*ksymtab_filter_word(ksymtab, hash) & mask) == mask;
+}
+
 void ksymtab_ksym_mark(struct ksym *ksym)
 {
 	if (!ksym->mark)
@@ -274,6 +338,7 @@ void ksymtab_free(struct ksymtab *ksymtab)
 	h = ksymtab->hash;
 
 	hash_free(h);
+	free(ksymtab->filter);
 	free(ksymtab);
 }
 
@@ -287,6 +352,9 @@ struct ksymtab *ksymtab_new(size_t size)
 
 	ksymtab = safe_zmalloc(sizeof(*ksymtab));
 	ksymtab->hash = h;
+	ksymtab->filter_size = KSYMTAB_FILTER_SIZE;
+	ksymtab->filter = safe_zmalloc(KSYMTAB_FILTER_SIZE *
+				       sizeof(*ksymtab->filter));
 	/* ksymtab->mark_count is zeroed by the allocator */
 
 	return ksymtab;
@@ -299,6 +367,7 @@ struct ksym *ksymtab_add_sym(struct ksymtab *ksymtab,
 {
 	struct hash *h = ksymtab->hash;
 	struct ksym *ksym;
+	uint64_t hash;
 
 	ksym = safe_zmalloc(sizeof(*ksym) + len + 1);
 	memcpy(ksym->key, str, len);
@@ -309,6 +378,14 @@ struct ksym *ksymtab_add_sym(struct ksymtab *ksymtab,
 	/* ksym->link is zeroed by the allocator */
 	hash_add(h, ksym->key, ksym);
 
+	if (hash_get_count(h) > ksymtab->filter_size * KSYMTAB_FILTER_LOAD) {
+		ksymtab_filter_grow(ksymtab);
+	} else {
+		hash = ksymtab_filter_hash(ksym->key);
+		*ksymtab_filter_word(ksymtab, hash) |=
+			ksymtab_filter_mask(hash);
+	}
+
 	return ksym;
 }
 
@@ -388,6 +465,7 @@ struct ksymtab_symbol_filter_ctx
 	struct ksymtab *ksymtab;
 	struct ksymtab_section sec;
 	struct ksymtab_section sec_gpl;
+	size_t idx;
 };
 
 static int ksymtab_in_section(Elf64_Addr addr, struct ksymtab_section *sec)
@@ -400,7 +478,6 @@ static int ksymtab_in_section(Elf64_Addr addr, struct ksymtab_section *sec)
 static void ksymtab_symbol_filter(const char *name, uint64_t value, int bind, void *_ctx)
 {
 	struct ksymtab_symbol_filter_ctx *ctx = (struct ksymtab_symbol_filter_ctx *)_ctx;
-	static size_t i = 0;
 
 	if (strncmp(name, KSYMTAB_PREFIX, strlen(KSYMTAB_PREFIX)))
 		return;
@@ -410,7 +487,7 @@ static void ksymtab_symbol_filter(const char *name, uint64_t value, int bind, vo
 		return;
 
 	name += strlen(KSYMTAB_PREFIX);
-	ksymtab_add_sym(ctx->ksymtab, name, strlen(name), i++);
+	ksymtab_add_sym(ctx->ksymtab, name, strlen(name), ctx->idx++);
 }
 
 static struct ksymtab *parse_ksymtab_symbols(struct elf_data *data)
@@ -419,6 +496,7 @@ static struct ksymtab *parse_ksymtab_symbols(struct elf_data *data)
 	const char *unused;
 
 	ctx.ksymtab = ksymtab_new(KSYMTAB_SIZE);
+	ctx.idx = 0;
 
 	ctx.sec.addr = elf_get_section(data->elf,
 				       data->shstrndx,
@@ -638,6 +716,53 @@ int elf_get_endianness(struct elf_data *data, unsigned int *endianness)
 	return 0;
 }
 
+/*
+ * Get the GNU build-id of the ELF file as a hex string.
+ * Returns 1 if the file doesn't have one.
+ */
+int elf_get_build_id(struct elf_data *data, char **build_id)
+{
+	Elf_Scn *scn = NULL;
+	GElf_Shdr shdr;
+	Elf_Data *d;
+	GElf_Nhdr nhdr;
+	size_t off, next, name_off, desc_off;
+	const unsigned char *desc;
+	char *hex;
+	size_t i;
+
+	while ((scn = elf_nextscn(data->elf, scn)) != NULL) {
+		if (gelf_getshdr(scn, &shdr) != &shdr)
+			fail("getshdr() failed: %s\n", elf_errmsg(-1));
+		if (shdr.sh_type != SHT_NOTE)
+			continue;
+
+		d = elf_getdata(scn, NULL);
+		if (d == NULL)
+			continue;
+
+		off = 0;
+		while ((next = gelf_getnote(d, off, &nhdr, &name_off,
+					    &desc_off)) > 0) {
+			off = next;
+			if (nhdr.n_type != NT_GNU_BUILD_ID ||
+			    nhdr.n_namesz != sizeof(ELF_NOTE_GNU) ||
+			    memcmp((char *)d->d_buf + name_off, ELF_NOTE_GNU,
+				   sizeof(ELF_NOTE_GNU)) != 0)
+				continue;
+
+			desc = (unsigned char *)d->d_buf + desc_off;
+			hex = safe_zmalloc(nhdr.n_descsz * 2 + 1);
+			for (i = 0; i < nhdr.n_descsz; i++)
+				sprintf(hex + i * 2, "%02x", desc[i]);
+			*build_id = hex;
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
 static inline int elf_get_strtab(struct elf_data *data)
 {
 	const char *strtab;
@@ -36,6 +36,7 @@ struct ksym {
 	char *link;
 	struct ksymtab *ksymtab;
 	char *ns;
+	unsigned int gen; /* Index of the generate job which added it */
 	char key[];
 };
 
@@ -72,7 +73,10 @@ extern int elf_get_exported(struct elf_data *, struct ksymtab **,
 			    struct ksymtab **);
 extern void elf_close(struct elf_data *);
 extern int elf_get_endianness(struct elf_data *, unsigned int *);
+extern int elf_get_build_id(struct elf_data *, char **);
 extern struct ksym *ksymtab_find(struct ksymtab *, const char *);
+extern uint64_t ksymtab_filter_hash(const char *);
+extern bool ksymtab_filter_test(struct ksymtab *, uint64_t);
 extern size_t ksymtab_len(struct ksymtab *);
 extern struct ksymtab *ksymtab_new(size_t);
 extern struct ksym *ksymtab_add_sym(struct ksymtab *,
@@ -56,7 +56,6 @@ struct list_node *list_add(struct list *list, void *data)
 	node->data = data;
 	node->next = NULL;
 	node->prev = list->last;
-	node->list = list;
 
 	if (list_len(list) == 0)
 		list->first = node;
@@ -68,38 +67,11 @@ struct list_node *list_add(struct list *list, void *data)
 	return node;
 }
 
-void list_del(struct list_node *node)
-{
-	struct list *list;
-	struct list_node *next_temp;
-
-	list = node->list;
-	if (list->first == node)
-		list->first = node->next;
-	if (list->last == node)
-		list->last = node->prev;
-
-	next_temp = node->next;
-	if (node->next)
-		node->next->prev = node->prev;
-	if (node->prev)
-		node->prev->next = next_temp;
-
-	list->len--;
-
-	free(node);
-}
-
 void list_concat(struct list *dst, struct list *src)
 {
-	struct list_node *iter;
-
 	if (list_len(src) == 0)
 		return;
 
-	LIST_FOR_EACH(src, iter)
-		iter->list = dst;
-
 	if (dst->len == 0) {
 		dst->first = src->first;
 		dst->last = src->last;
@@ -1,11 +1,13 @@
 #ifndef LIST_H_
 #define LIST_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+
 struct list_node {
 	void *data;
 	struct list_node *next;
 	struct list_node *prev;
-	struct list *list;
 };
 
 struct list {
@@ -33,12 +35,7 @@ void list_free(struct list *list);
 struct list_node *list_add(struct list *list, void *data);
 
 /*
- * Removes node from the parent list, without freeing it.
- */
-void list_del(struct list_node *node);
-
-/*
- * Appends nodes from src to dst, emptying src.
+ * Appends nodes from src to dst, emptying src. Constant time.
  */
 void list_concat(struct list *dst, struct list *src);
 
@@ -56,10 +53,102 @@ static inline void *list_node_data(struct list_node *node)
 	return node->data;
 }
 
-static inline struct list_node *list_node_add(struct list_node *node,
-					      void *data)
+/*
+ * Intrusive circular doubly linked list. The links are embedded in the
+ * items, so linking an item doesn't allocate and an item can unlink
+ * itself without knowing its list. The head is a link not embedded in
+ * any item. Unlinked items have NULL next.
+ */
+struct ilist {
+	struct ilist *next;
+	struct ilist *prev;
+};
+
+#define ilist_entry(link, type, member) \
+	((type *)((char *)(link) - offsetof(type, member)))
+
+#define ILIST_FOR_EACH(head, iter) \
+	for ((iter) = (head)->next; (iter) != (head); (iter) = (iter)->next)
+
+/* Allows to unlink iter in the body */
+#define ILIST_FOR_EACH_SAFE(head, iter, tmp) \
+	for ((iter) = (head)->next, (tmp) = (iter)->next; (iter) != (head); \
+	     (iter) = (tmp), (tmp) = (iter)->next)
+
+static inline void ilist_init(struct ilist *head)
 {
-	return list_add(node->list, data);
+	head->next = head;
+	head->prev = head;
+}
+
+static inline bool ilist_empty(const struct ilist *head)
+{
+	return head->next == head;
+}
+
+static inline bool ilist_linked(const struct ilist *link)
+{
+	return link->next != NULL;
+}
+
+static inline void ilist_insert(struct ilist *link, struct ilist *prev,
+				struct ilist *next)
+{
+	link->prev = prev;
+	link->next = next;
+	prev->next = link;
+	next->prev = link;
+}
+
+/* Links link right after pos */
+static inline void ilist_add(struct ilist *pos, struct ilist *link)
+{
+	ilist_insert(link, pos, pos->next);
+}
+
+static inline void ilist_add_tail(struct ilist *head, struct ilist *link)
+{
+	ilist_insert(link, head->prev, head);
+}
+
+static inline void ilist_del(struct ilist *link)
+{
+	link->prev->next = link->next;
+	link->next->prev = link->prev;
+	link->next = NULL;
+	link->prev = NULL;
+}
+
+/* Puts link to the place of old, which gets unlinked */
+static inline void ilist_replace(struct ilist *old, struct ilist *link)
+{
+	ilist_insert(link, old->prev, old->next);
+	old->next = NULL;
+	old->prev = NULL;
+}
+
+/* Appends the items of src to dst, emptying src. Constant time. */
+static inline void ilist_splice_tail(struct ilist *dst, struct ilist *src)
+{
+	if (ilist_empty(src))
+		return;
+
+	src->next->prev = dst->prev;
+	dst->prev->next = src->next;
+	src->prev->next = dst;
+	dst->prev = src->prev;
+	ilist_init(src);
+}
+
+static inline size_t ilist_len(const struct ilist *head)
+{
+	const struct ilist *iter;
+	size_t len = 0;
+
+	ILIST_FOR_EACH(head, iter)
+		len++;
+
+	return len;
 }
 
 #endif /* LIST_H_ */
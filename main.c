@@ -33,6 +33,7 @@
 #include "generate.h"
 #include "compare.h"
 #include "show.h"
+#include "kabipack.h"
 #include "utils.h"
 
 static char *progname;
@@ -42,8 +43,9 @@ void usage(void)
 	printf("Usage:\n"
 	    "\t %s generate [options] kernel_dir\n"
 	    "\t %s show [options] kabi_file...\n"
-	    "\t %s compare [options] kabi_dir kabi_dir...\n",
-	       progname, progname, progname);
+	    "\t %s compare [options] kabi_dir kabi_dir...\n"
+	    "\t %s unpack [options] kabi_pack kabi_dir\n",
+	       progname, progname, progname, progname);
 	exit(1);
 }
 
@@ -66,6 +68,8 @@ int main(int argc, char **argv)
 		ret = compare(argc, argv);
 	else if (strcmp(argv[0], "show") == 0)
 		ret = show(argc, argv);
+	else if (strcmp(argv[0], "unpack") == 0)
+		ret = unpack(argc, argv);
 	else
 		usage();
 
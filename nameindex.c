@@ -0,0 +1,522 @@
+/*
+	Copyright(C) 2016, Red Hat, Inc., Stanislav Kozina
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * libdw doesn't provide any API for the name indexes, so the sections are
+ * parsed here. Only the names and the CUs are needed, the hash tables are
+ * not used: every name is handed to the caller, which looks it up in its
+ * own tables.
+ *
+ * The sections are read as they are in the file, so an index which needs
+ * relocating (as in a kernel module linked from objects with their own
+ * indexes) or is compressed is not used.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dwarf.h>
+#include <libelf.h>
+#include <gelf.h>
+
+#include "utils.h"
+#include "nameindex.h"
+
+#define	DEBUG_NAMES_SECTION	".debug_names"
+#define	GDB_INDEX_SECTION	".gdb_index"
+
+struct reader {
+	const unsigned char *p;
+	const unsigned char *end;
+	bool big_endian;
+	bool error; /* Set once anything is out of bounds or unknown */
+};
+
+struct name_index_ctx {
+	Dwarf *dbg;
+	name_index_name_cb_t *name_cb;
+	name_index_cu_cb_t *cu_cb;
+	void *arg;
+};
+
+struct names_abbrev {
+	uint64_t code;
+	const unsigned char *attrs; /* The (index, form) pairs */
+};
+
+static void reader_init(struct reader *r, const void *buf, size_t size,
+			bool big_endian)
+{
+	r->p = buf;
+	r->end = r->p + size;
+	r->big_endian = big_endian;
+	r->error = false;
+}
+
+static bool reader_has(struct reader *r, uint64_t size)
+{
+	if (r->error || (uint64_t)(r->end - r->p) < size)
+		r->error = true;
+	return !r->error;
+}
+
+static void reader_skip(struct reader *r, uint64_t size)
+{
+	if (reader_has(r, size))
+		r->p += size;
+}
+
+/* Split off the next size bytes into a reader of their own */
+static struct reader reader_sub(struct reader *r, uint64_t size)
+{
+	struct reader sub = *r;
+
+	if (reader_has(r, size)) {
+		sub.end = r->p + size;
+		r->p += size;
+	}
+	sub.error = r->error;
+
+	return sub;
+}
+
+static uint64_t read_uint(struct reader *r, size_t size)
+{
+	uint64_t val = 0;
+	size_t i;
+
+	if (!reader_has(r, size))
+		return 0;
+
+	for (i = 0; i < size; i++) {
+		size_t byte = r->big_endian ? i : size - 1 - i;
+
+		val = (val << 8) | r->p[byte];
+	}
+	r->p += size;
+
+	return val;
+}
+
+/* Signed values are only skipped, so this reads those too */
+static uint64_t read_uleb128(struct reader *r)
+{
+	uint64_t val = 0;
+	unsigned int shift = 0;
+	unsigned char byte;
+
+	do {
+		if (!reader_has(r, 1))
+			return 0;
+		byte = *r->p++;
+		if (shift < 64)
+			val |= (uint64_t)(byte & 0x7f) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+
+	return val;
+}
+
+static uint64_t read_form(struct reader *r, uint64_t form, size_t offset_size)
+{
+	switch (form) {
+	case DW_FORM_flag_present:
+		return 1;
+	case DW_FORM_flag:
+	case DW_FORM_data1:
+	case DW_FORM_ref1:
+		return read_uint(r, 1);
+	case DW_FORM_data2:
+	case DW_FORM_ref2:
+		return read_uint(r, 2);
+	case DW_FORM_data4:
+	case DW_FORM_ref4:
+		return read_uint(r, 4);
+	case DW_FORM_data8:
+	case DW_FORM_ref8:
+	case DW_FORM_ref_sig8:
+		return read_uint(r, 8);
+	case DW_FORM_data16:
+		reader_skip(r, 16);
+		return 0;
+	case DW_FORM_udata:
+	case DW_FORM_sdata:
+	case DW_FORM_ref_udata:
+		return read_uleb128(r);
+	case DW_FORM_strp:
+	case DW_FORM_sec_offset:
+		return read_uint(r, offset_size);
+	default:
+		r->error = true;
+		return 0;
+	}
+}
+
+static struct names_abbrev *names_abbrev_find(struct names_abbrev *abbrevs,
+					      size_t cnt, uint64_t code)
+{
+	size_t i;
+
+	for (i = 0; i < cnt; i++) {
+		if (abbrevs[i].code == code)
+			return &abbrevs[i];
+	}
+
+	return NULL;
+}
+
+static struct names_abbrev *names_abbrevs_read(struct reader *r,
+					       size_t *cnt)
+{
+	struct names_abbrev *abbrevs = NULL;
+	size_t alloc = 0;
+	uint64_t code;
+
+	*cnt = 0;
+	while ((code = read_uleb128(r)) != 0) {
+		uint64_t idx, form;
+
+		if (*cnt == alloc) {
+			alloc = alloc ? alloc * 2 : 16;
+			abbrevs = safe_realloc(abbrevs,
+					       alloc * sizeof(*abbrevs));
+		}
+		abbrevs[*cnt].code = code;
+		read_uleb128(r); /* Tag */
+		abbrevs[(*cnt)++].attrs = r->p;
+
+		do {
+			idx = read_uleb128(r);
+			form = read_uleb128(r);
+		} while ((idx != 0 || form != 0) && !r->error);
+	}
+
+	return abbrevs;
+}
+
+/*
+ * Hand over the CUs of all the non-type unit entries in the entry list of
+ * a name.
+ */
+static void names_entries_read(struct name_index_ctx *ctx, const char *name,
+			       struct reader *r, struct reader *abbrev_table,
+			       struct names_abbrev *abbrevs, size_t abbrev_cnt,
+			       Dwarf_Off *cus, uint64_t cu_cnt,
+			       size_t offset_size)
+{
+	uint64_t code;
+
+	while ((code = read_uleb128(r)) != 0) {
+		struct names_abbrev *abbrev;
+		struct reader attrs;
+		uint64_t idx, form, val;
+		uint64_t cu = cu_cnt == 1 ? 0 : cu_cnt;
+		bool type_unit = false;
+
+		abbrev = names_abbrev_find(abbrevs, abbrev_cnt, code);
+		if (abbrev == NULL) {
+			r->error = true;
+			return;
+		}
+
+		attrs = *abbrev_table;
+		attrs.p = abbrev->attrs;
+		for (;;) {
+			idx = read_uleb128(&attrs);
+			form = read_uleb128(&attrs);
+			if ((idx == 0 && form == 0) || attrs.error)
+				break;
+
+			val = read_form(r, form, offset_size);
+			if (idx == DW_IDX_compile_unit)
+				cu = val;
+			else if (idx == DW_IDX_type_unit)
+				type_unit = true;
+		}
+
+		if (attrs.error || r->error)
+			r->error = true;
+		if (r->error)
+			return;
+
+		if (type_unit)
+			continue;
+		if (cu >= cu_cnt) {
+			r->error = true;
+			return;
+		}
+		ctx->name_cb(name, cus[cu], ctx->arg);
+	}
+}
+
+/* One name table of .debug_names, r holds the unit after its length */
+static bool debug_names_unit(struct name_index_ctx *ctx, struct reader *r,
+			     size_t offset_size)
+{
+	uint64_t cu_cnt, local_tu_cnt, foreign_tu_cnt;
+	uint64_t bucket_cnt, name_cnt, abbrev_size, aug_size;
+	struct reader cu_list, str_offs, entry_offs, abbrev_table, pool;
+	struct names_abbrev *abbrevs;
+	size_t abbrev_cnt;
+	Dwarf_Off *cus;
+	uint64_t i;
+
+	if (read_uint(r, 2) != 5)
+		return false;
+	read_uint(r, 2); /* Padding */
+
+	cu_cnt = read_uint(r, 4);
+	local_tu_cnt = read_uint(r, 4);
+	foreign_tu_cnt = read_uint(r, 4);
+	bucket_cnt = read_uint(r, 4);
+	name_cnt = read_uint(r, 4);
+	abbrev_size = read_uint(r, 4);
+	aug_size = read_uint(r, 4);
+	reader_skip(r, aug_size);
+
+	cu_list = reader_sub(r, cu_cnt * offset_size);
+	reader_skip(r, local_tu_cnt * offset_size + foreign_tu_cnt * 8);
+	/* The hash table: buckets and hashes */
+	if (bucket_cnt > 0)
+		reader_skip(r, bucket_cnt * 4 + name_cnt * 4);
+	str_offs = reader_sub(r, name_cnt * offset_size);
+	entry_offs = reader_sub(r, name_cnt * offset_size);
+	abbrev_table = reader_sub(r, abbrev_size);
+	pool = *r;
+	if (r->error)
+		return false;
+
+	cus = safe_zmalloc((cu_cnt + 1) * sizeof(*cus));
+	for (i = 0; i < cu_cnt; i++) {
+		cus[i] = read_uint(&cu_list, offset_size);
+		ctx->cu_cb(cus[i], ctx->arg);
+	}
+
+	abbrevs = names_abbrevs_read(&abbrev_table, &abbrev_cnt);
+
+	for (i = 0; i < name_cnt && !abbrev_table.error; i++) {
+		uint64_t str_off = read_uint(&str_offs, offset_size);
+		uint64_t entry_off = read_uint(&entry_offs, offset_size);
+		struct reader entries = pool;
+		const char *name;
+
+		name = dwarf_getstring(ctx->dbg, str_off, NULL);
+		if (name == NULL) {
+			r->error = true;
+			break;
+		}
+
+		reader_skip(&entries, entry_off);
+		names_entries_read(ctx, name, &entries, &abbrev_table,
+				   abbrevs, abbrev_cnt, cus, cu_cnt,
+				   offset_size);
+		if (entries.error) {
+			r->error = true;
+			break;
+		}
+	}
+
+	free(abbrevs);
+	free(cus);
+
+	return !r->error && !abbrev_table.error;
+}
+
+static bool debug_names_walk(struct name_index_ctx *ctx, struct reader *r)
+{
+	while (r->p < r->end) {
+		size_t offset_size = 4;
+		uint64_t length;
+		struct reader unit;
+
+		length = read_uint(r, 4);
+		if (length == 0xffffffff) {
+			length = read_uint(r, 8);
+			offset_size = 8;
+		} else if (length >= 0xfffffff0) {
+			return false;
+		}
+
+		unit = reader_sub(r, length);
+		if (r->error || !debug_names_unit(ctx, &unit, offset_size))
+			return false;
+	}
+
+	return true;
+}
+
+/* The .gdb_index is always little endian */
+static bool gdb_index_walk(struct name_index_ctx *ctx, struct reader *r)
+{
+	const unsigned char *start = r->p;
+	uint64_t version, cu_off, tu_off, addr_off, sym_off, sym_end, pool_off;
+	uint64_t cu_cnt, tu_cnt, slot_cnt;
+	struct reader cu_list, symbols, pool;
+	Dwarf_Off *cus;
+	uint64_t i;
+
+	version = read_uint(r, 4);
+	if (version < 7 || version > 9)
+		return false;
+
+	cu_off = read_uint(r, 4);
+	tu_off = read_uint(r, 4);
+	addr_off = read_uint(r, 4);
+	sym_off = read_uint(r, 4);
+	/* Version 9 added the shortcut table after the symbols */
+	sym_end = version >= 9 ? read_uint(r, 4) : 0;
+	pool_off = read_uint(r, 4);
+	if (version < 9)
+		sym_end = pool_off;
+	if (r->error)
+		return false;
+
+	if (cu_off > tu_off || tu_off > addr_off || sym_off > sym_end ||
+	    sym_end > pool_off || pool_off > (uint64_t)(r->end - start))
+		return false;
+	cu_cnt = (tu_off - cu_off) / 16;
+	tu_cnt = (addr_off - tu_off) / 24;
+	slot_cnt = (sym_end - sym_off) / 8;
+
+	reader_init(&cu_list, start + cu_off, tu_off - cu_off, false);
+	reader_init(&symbols, start + sym_off, sym_end - sym_off, false);
+	reader_init(&pool, start + pool_off, r->end - start - pool_off, false);
+
+	cus = safe_zmalloc((cu_cnt + 1) * sizeof(*cus));
+	for (i = 0; i < cu_cnt; i++) {
+		cus[i] = read_uint(&cu_list, 8);
+		read_uint(&cu_list, 8); /* Length */
+		ctx->cu_cb(cus[i], ctx->arg);
+	}
+
+	for (i = 0; i < slot_cnt && !pool.error; i++) {
+		uint64_t name_off = read_uint(&symbols, 4);
+		uint64_t vec_off = read_uint(&symbols, 4);
+		struct reader vec = pool;
+		const char *name;
+		uint64_t cnt, j;
+
+		if (name_off == 0 && vec_off == 0)
+			continue;
+
+		if (name_off >= (uint64_t)(pool.end - pool.p) ||
+		    memchr(pool.p + name_off, '\0',
+			   pool.end - pool.p - name_off) == NULL) {
+			pool.error = true;
+			break;
+		}
+		name = (const char *)pool.p + name_off;
+
+		reader_skip(&vec, vec_off);
+		cnt = read_uint(&vec, 4);
+		for (j = 0; j < cnt && !vec.error; j++) {
+			/* The lowest 24 bits index the CUs and then the TUs */
+			uint64_t cu = read_uint(&vec, 4) & 0xffffff;
+
+			if (vec.error)
+				break;
+			if (cu >= cu_cnt + tu_cnt)
+				vec.error = true;
+			else if (cu < cu_cnt)
+				ctx->name_cb(name, cus[cu], ctx->arg);
+		}
+		if (vec.error)
+			pool.error = true;
+	}
+
+	free(cus);
+
+	return !pool.error && !cu_list.error && !symbols.error;
+}
+
+/*
+ * Find the section by name, NULL if it's missing or it can't be used as
+ * it is in the file.
+ */
+static Elf_Data *name_index_section(Elf *elf, const char *name)
+{
+	Elf_Scn *scn = NULL;
+	Elf_Scn *found = NULL;
+	GElf_Shdr shdr;
+	size_t shstrndx;
+	const char *scn_name;
+
+	if (elf_getshdrstrndx(elf, &shstrndx) != 0)
+		return NULL;
+
+	while ((scn = elf_nextscn(elf, scn)) != NULL) {
+		if (gelf_getshdr(scn, &shdr) == NULL)
+			return NULL;
+		scn_name = elf_strptr(elf, shstrndx, shdr.sh_name);
+		if (scn_name != NULL && strcmp(scn_name, name) == 0) {
+			found = scn;
+			break;
+		}
+	}
+	if (found == NULL ||
+	    shdr.sh_type != SHT_PROGBITS || (shdr.sh_flags & SHF_COMPRESSED))
+		return NULL;
+
+	/* Any relocations of the section? */
+	scn = NULL;
+	while ((scn = elf_nextscn(elf, scn)) != NULL) {
+		if (gelf_getshdr(scn, &shdr) == NULL)
+			return NULL;
+		if ((shdr.sh_type == SHT_REL || shdr.sh_type == SHT_RELA) &&
+		    shdr.sh_info == elf_ndxscn(found))
+			return NULL;
+	}
+
+	return elf_getdata(found, NULL);
+}
+
+bool name_index_walk(Dwarf *dbg, name_index_name_cb_t *name_cb,
+		     name_index_cu_cb_t *cu_cb, void *arg)
+{
+	struct name_index_ctx ctx;
+	struct reader r;
+	Elf *elf = dwarf_getelf(dbg);
+	Elf_Data *data;
+	char *ident;
+
+	if (elf == NULL)
+		return false;
+
+	ident = elf_getident(elf, NULL);
+	if (ident == NULL)
+		return false;
+
+	ctx.dbg = dbg;
+	ctx.name_cb = name_cb;
+	ctx.cu_cb = cu_cb;
+	ctx.arg = arg;
+
+	data = name_index_section(elf, DEBUG_NAMES_SECTION);
+	if (data != NULL && data->d_buf != NULL) {
+		reader_init(&r, data->d_buf, data->d_size,
+			    ident[EI_DATA] == ELFDATA2MSB);
+		return debug_names_walk(&ctx, &r);
+	}
+
+	data = name_index_section(elf, GDB_INDEX_SECTION);
+	if (data != NULL && data->d_buf != NULL) {
+		reader_init(&r, data->d_buf, data->d_size, false);
+		return gdb_index_walk(&ctx, &r);
+	}
+
+	return false;
+}
@@ -0,0 +1,43 @@
+/*
+	Copyright(C) 2016, Red Hat, Inc., Stanislav Kozina
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Readers of the accelerated name lookup tables: the DWARF 5 .debug_names
+ * section and the .gdb_index section added by gdb-add-index.
+ */
+
+#ifndef NAMEINDEX_H_
+#define	NAMEINDEX_H_
+
+#include <stdbool.h>
+#include <elfutils/libdw.h>
+
+typedef void name_index_name_cb_t(const char *name, Dwarf_Off cu_off,
+				  void *arg);
+typedef void name_index_cu_cb_t(Dwarf_Off cu_off, void *arg);
+
+/*
+ * Walk the name index of the debug info. cu_cb is called for every CU the
+ * index covers, name_cb for every indexed name with the offset of the CU
+ * defining it. The offsets are the ones of the CU headers.
+ * Returns false if there is no usable index; the callbacks might have been
+ * called already in that case.
+ */
+extern bool name_index_walk(Dwarf *dbg, name_index_name_cb_t *name_cb,
+			    name_index_cu_cb_t *cu_cb, void *arg);
+
+#endif /* NAMEINDEX_H_ */
@@ -34,6 +34,8 @@
 #include <getopt.h>
 #include <libgen.h>
 #include <sys/stat.h>
+#include <pthread.h>
+#include <stdint.h>
 
 #include "objects.h"
 #include "utils.h"
@@ -44,54 +46,88 @@
 #define C_INDENT_OFFSET   8
 #define DBG_INDENT_OFFSET 4
 
-obj_list_t *obj_list_new(obj_t *obj)
+/*
+ * The objects are allocated from the arena set by the thread, so a whole
+ * tree is freed at once with the arena of its owner.
+ */
+static __thread struct arena *obj_arena;
+
+struct arena *obj_arena_set(struct arena *arena)
 {
-	obj_list_t *list = safe_zmalloc(sizeof(obj_list_t));
-	list->member = obj;
-	list->next = NULL;
-	return list;
+	struct arena *prev = obj_arena;
+
+	obj_arena = arena;
+
+	return prev;
 }
 
-static void obj_list_init(obj_list_head_t *head, obj_t *obj)
+static void *obj_zalloc(size_t size)
 {
-	obj_list_t *list = obj_list_new(obj);
-	head->first = head->last = list;
+	void *res;
+
+	if (obj_arena == NULL)
+		fail("No arena to allocate the objects from\n");
+
+	res = arena_alloc(obj_arena, size);
+	memset(res, 0, size);
+
+	return res;
 }
 
-obj_list_head_t *obj_list_head_new(obj_t *obj)
+#define	OBJ_LIST_MIN_SIZE	4
+
+static obj_list_t *obj_list_alloc(unsigned int size)
 {
-	obj_list_head_t *h = safe_zmalloc(sizeof(obj_list_head_t));
+	obj_list_t *list;
 
-	obj_list_init(h, obj);
+	/* Keep room for the terminating NULL */
+	list = obj_zalloc(sizeof(*list) +
+			  (size + 1) * sizeof(list->members[0]));
+	list->size = size;
 
-	return h;
+	return list;
 }
 
-static bool obj_list_empty(obj_list_head_t *head)
+obj_list_t *obj_list_new(obj_t *obj)
 {
-	return head->first == NULL;
+	obj_list_t *list = obj_list_alloc(OBJ_LIST_MIN_SIZE);
+
+	list->members[list->cnt++] = obj;
+
+	return list;
 }
 
-void obj_list_add(obj_list_head_t *head, obj_t *obj)
+/*
+ * Append obj to the list and return the list, which is moved when it
+ * needs to grow. The old array stays in the arena.
+ */
+obj_list_t *obj_list_add(obj_list_t *list, obj_t *obj)
 {
-	obj_list_t *list;
+	if (list == NULL)
+		return obj_list_new(obj);
 
-	if (obj_list_empty(head)) {
-		obj_list_init(head, obj);
-		return;
+	if (list->cnt == list->size) {
+		unsigned int size = list->size * 2;
+		obj_list_t *new;
+
+		if (size < OBJ_LIST_MIN_SIZE)
+			size = OBJ_LIST_MIN_SIZE;
+
+		new = obj_list_alloc(size);
+		new->cnt = list->cnt;
+		memcpy(new->members, list->members,
+		       list->cnt * sizeof(list->members[0]));
+		list = new;
 	}
-	list = obj_list_new(obj);
 
-	if (head->last->next)
-		fprintf(stderr, "head->last is not the last\n");
+	list->members[list->cnt++] = obj;
 
-	head->last->next = list;
-	head->last = list;
+	return list;
 }
 
 obj_t *obj_new(obj_types type, char *name)
 {
-	obj_t *new = safe_zmalloc(sizeof(obj_t));
+	obj_t *new = obj_zalloc(sizeof(obj_t));
 
 	new->type = type;
 	new->name = global_string_get_move(name);
@@ -100,62 +136,39 @@ obj_t *obj_new(obj_types type, char *name)
 	return new;
 }
 
-static void _obj_free(obj_t *o, obj_t *skip);
+static void _obj_detach(obj_t *o, obj_t *skip);
 
-static void _obj_list_free(obj_list_head_t *l, obj_t *skip)
+static void _obj_list_detach(obj_t **list, obj_t *skip)
 {
-	obj_list_t *list;
-	obj_list_t *next;
-
-	if (l == NULL)
-		return;
-
-	list = l->first;
-	free(l);
-
-	while (list) {
-		_obj_free(list->member, skip);
-		next = list->next;
-		free(list);
-		list = next;
-	}
-}
-
-static void obj_list_free(obj_list_head_t *l)
-{
-	_obj_list_free(l, NULL);
+	for (; *list; list++)
+		_obj_detach(*list, skip);
 }
 
 /*
- * Free the tree o, but keep the subtree skip.
+ * Detach the tree o, but keep the subtree skip.
  */
-static void _obj_free(obj_t *o, obj_t *skip)
+static void _obj_detach(obj_t *o, obj_t *skip)
 {
-	if (!o || (o == skip))
+	/* The shared subtrees have no reffile */
+	if (!o || (o == skip) || o->is_shared)
 		return;
 
-	if (o->type == __type_reffile && o->depend_rec_node) {
-		list_del(o->depend_rec_node);
-		o->depend_rec_node = NULL;
-	}
+	if (o->type == __type_reffile && ilist_linked(&o->depend_link))
+		ilist_del(&o->depend_link);
 
-	_obj_list_free(o->member_list, skip);
+	_obj_list_detach(obj_members(o), skip);
 
 	if (o->ptr)
-		_obj_free(o->ptr, skip);
-
-	if (is_weak(o))
-		free(o->link);
-
-	free(o);
+		_obj_detach(o->ptr, skip);
 }
 
 /*
- * Free the all object
+ * Remove the reffile objects of the tree from the dependents of their
+ * records. The memory of the tree is freed with its arena.
  */
-void obj_free(obj_t *o)
+void obj_detach(obj_t *o)
 {
-	_obj_free(o, NULL);
+	_obj_detach(o, NULL);
 }
 
 #define _CREATE_NEW_FUNC(type, suffix)			\
@@ -451,7 +464,7 @@ static pp_t print_reffile(obj_t *o, int depth, const char *prefix)
 static pp_t print_structlike(obj_t *o, int depth, const char *prefix)
 {
 	pp_t ret = {NULL, NULL}, tmp;
-	obj_list_t *list = NULL;
+	obj_t **list = obj_members(o);
 	char *s, *margin;
 
 	if (o->name)
@@ -459,14 +472,12 @@ static pp_t print_structlike(obj_t *o, int depth, const char *prefix)
 	else
 		safe_asprintf(&s, "%s {\n", typetostr(o));
 
-	if (o->member_list)
-		list = o->member_list->first;
-	while (list) {
-		tmp = _print_tree(list->member, depth+1, true, prefix);
+	while (*list) {
+		tmp = _print_tree(*list, depth+1, true, prefix);
 		postfix_str_free(&s, tmp.prefix);
 		postfix_str_free(&s, tmp.postfix);
 		postfix_str(&s, o->type == __type_enum ? ",\n" : ";\n");
-		list = list->next;
+		list++;
 	}
 
 	margin = print_margin(prefix, depth);
@@ -480,7 +491,7 @@ static pp_t print_structlike(obj_t *o, int depth, const char *prefix)
 static pp_t print_func(obj_t *o, int depth, const char *prefix)
 {
 	pp_t ret = {NULL, NULL}, return_type;
-	obj_list_t *list = NULL;
+	obj_t **list = obj_members(o);
 	obj_t *next = o->ptr;
 	char *s, *margin;
 	const char *name;
@@ -495,14 +506,12 @@ static pp_t print_func(obj_t *o, int depth, const char *prefix)
 
 	safe_asprintf(&s, "%s(\n", name);
 
-	if (o->member_list)
-		list = o->member_list->first;
-	while (list) {
-		pp_t arg = _print_tree(list->member, depth+1, true, prefix);
+	while (*list) {
+		pp_t arg = _print_tree(*list, depth+1, true, prefix);
 		postfix_str_free(&s, arg.prefix);
 		postfix_str_free(&s, arg.postfix);
-		list = list->next;
-		postfix_str(&s, list ? ",\n" : "\n");
+		list++;
+		postfix_str(&s, *list ? ",\n" : "\n");
 	}
 
 	margin = print_margin(prefix, depth);
@@ -697,17 +706,16 @@ void obj_print_tree(obj_t *root)
 
 static void fill_parent_rec(obj_t *o, obj_t *parent)
 {
-	obj_list_t *list = NULL;
+	obj_t **list;
+
+	/* Shared by many parents */
+	if (o->is_shared)
+		return;
 
 	o->parent = parent;
 
-	if (o->member_list)
-		list = o->member_list->first;
-
-	while (list) {
-		fill_parent_rec(list->member, o);
-		list = list->next;
-	}
+	for (list = obj_members(o); *list; list++)
+		fill_parent_rec(*list, o);
 
 	if (o->ptr)
 		fill_parent_rec(o->ptr, o);
@@ -721,19 +729,19 @@ void obj_fill_parent(obj_t *root)
 	fill_parent_rec(root, NULL);
 }
 
-static int walk_list(obj_list_t *list, cb_t cb_pre, cb_t cb_in, cb_t cb_post,
+static int walk_list(obj_t **list, cb_t cb_pre, cb_t cb_in, cb_t cb_post,
 			void *args, bool ptr_first)
 {
 	int ret = CB_CONT;
 
-	while (list) {
-		ret = obj_walk_tree3(list->member, cb_pre, cb_in, cb_post,
+	while (*list) {
+		ret = obj_walk_tree3(*list, cb_pre, cb_in, cb_post,
 				 args, ptr_first);
 		if (ret == CB_FAIL)
 			return ret;
 		else
 			ret = CB_CONT;
-		list = list->next;
+		list++;
 	}
 
 	return ret;
@@ -769,7 +777,7 @@ static int walk_ptr(obj_t *o, cb_t cb_pre, cb_t cb_in, cb_t cb_post,
 int obj_walk_tree3(obj_t *o, cb_t cb_pre, cb_t cb_in, cb_t cb_post,
 			void *args, bool ptr_first)
 {
-	obj_list_t *list = NULL;
+	obj_t **list;
 	int ret = CB_CONT;
 
 	if (cb_pre) {
@@ -778,9 +786,7 @@ int obj_walk_tree3(obj_t *o, cb_t cb_pre, cb_t cb_in, cb_t cb_post,
 			return ret;
 	}
 
-	if (o->member_list)
-		list = o->member_list->first;
-
+	list = obj_members(o);
 
 	if (ptr_first)
 		ret = walk_ptr(o, cb_pre, cb_in, cb_post, args, ptr_first);
@@ -905,7 +911,6 @@ int obj_debug_tree(obj_t *root)
 static int hide_kabi_cb(obj_t *o, void *args)
 {
 	obj_t *kabi_struct, *new, *old, *parent = o->parent, *keeper;
-	obj_list_head_t *lh;
 	obj_list_t *l;
 	bool show_new_field = (bool) args;
 
@@ -923,17 +928,16 @@ static int hide_kabi_cb(obj_t *o, void *args)
 
 	/* Hide RH_KABI_REPLACE */
 	if ((o->type != __type_union) || o->name ||
-	    !(lh = o->member_list) || obj_list_empty(lh) ||
-	    !(l = lh->first) || !(new = l->member) ||
-	    !(l = l->next) || !(kabi_struct = l->member) ||
+	    !(l = o->member_list) || l->cnt < 2 ||
+	    !(new = l->members[0]) || !(kabi_struct = l->members[1]) ||
 	    (kabi_struct->type != __type_var) ||
 	    !kabi_struct->name ||
 	    strncmp(kabi_struct->name, RH_KABI_HIDE, RH_KABI_HIDE_LEN))
 		return CB_CONT;
 
 	if (!kabi_struct->ptr || kabi_struct->ptr->type != __type_struct ||
-	    !(lh = kabi_struct->ptr->member_list) || obj_list_empty(lh) ||
-	    !(l = lh->first) || !(old = l->member))
+	    !(l = kabi_struct->ptr->member_list) || l->cnt == 0 ||
+	    !(old = l->members[0]))
 		fail("Unexpeted rh_kabi_hide struct format\n");
 
 	/*
@@ -984,8 +988,8 @@ static int hide_kabi_cb(obj_t *o, void *args)
 	parent->name = keeper->name;
 	parent->ptr = keeper->ptr;
 	parent->ptr->parent = parent;
-	_obj_free(o, keeper);
-	free(keeper);
+	/* The dropped nodes stay in the arena until the tree is freed */
+	_obj_detach(o, keeper);
 
 	return CB_SKIP;
 }
@@ -1013,6 +1017,9 @@ static bool obj_is_kabi_hide(obj_t *obj)
 
 bool obj_eq(obj_t *o1, obj_t *o2, bool ignore_versions)
 {
+	if (o1 == o2)
+		return true;
+
 	if (o1->type != o2->type)
 		return false;
 
@@ -1052,61 +1059,57 @@ bool obj_eq(obj_t *o1, obj_t *o2, bool ignore_versions)
 	return true;
 }
 
-static obj_t *obj_copy(obj_t *o1)
-{
-	obj_t *o;
-
-	o = safe_zmalloc(sizeof(*o));
-	*o = *o1;
-
-	o->ptr = NULL;
-	o->member_list = NULL;
-
-	if (o1->type == __type_reffile && o1->depend_rec_node)
-		o->depend_rec_node = list_node_add(o1->depend_rec_node, o);
-
-	return o;
-}
-
-obj_t *obj_merge(obj_t *o1, obj_t *o2, unsigned int flags);
-
-static obj_list_head_t *obj_members_merge(obj_list_head_t *list1,
-					  obj_list_head_t *list2,
-					  unsigned int flags)
+static obj_t *_obj_clone(obj_t *o, bool move)
 {
-	obj_list_head_t *res = NULL;
-	obj_list_t *l1;
-	obj_list_t *l2;
-	obj_t *o;
+	obj_t **l;
+	obj_t *res;
 
-	if (list1 == NULL || list2 == NULL)
-		return NULL;
+	if (o == NULL || o->is_shared)
+		return o;
 
-	l1 = list1->first;
-	l2 = list2->first;
+	res = obj_zalloc(sizeof(*res));
+	*res = *o;
 
-	while (l1 && l2) {
-		o = obj_merge(l1->member, l2->member, flags);
-		if (o == NULL)
-			goto cleanup;
+	res->parent = NULL;
+	res->member_list = NULL;
+	res->ptr = _obj_clone(o->ptr, move);
 
-		if (res == NULL)
-			res = obj_list_head_new(o);
-		else
-			obj_list_add(res, o);
+	if (o->type == __type_reffile) {
+		res->depend_link.next = NULL;
+		res->depend_link.prev = NULL;
+		if (move && ilist_linked(&o->depend_link))
+			ilist_replace(&o->depend_link, &res->depend_link);
+	}
 
-		l1 = l1->next;
-		l2 = l2->next;
-	};
+	if (o->member_list == NULL)
+		return res;
 
-	if (l1 || l2)
-		goto cleanup;
+	/* The copy doesn't need to grow, so it's allocated at its size */
+	res->member_list = obj_list_alloc(o->member_list->cnt);
+	for (l = o->member_list->members; *l; l++)
+		res->member_list->members[res->member_list->cnt++] =
+			_obj_clone(*l, move);
 
 	return res;
+}
 
-cleanup:
-	obj_list_free(res);
-	return NULL;
+/*
+ * Deep copy of the tree o into the current arena. The strings and the
+ * shared subtrees are shared with the original, the reffile objects are
+ * not added to the dependents of their records.
+ */
+obj_t *obj_clone(obj_t *o)
+{
+	return _obj_clone(o, false);
+}
+
+/*
+ * Like obj_clone(), but the copies of the reffile objects take the place
+ * of the originals in the dependents, so the original tree can be freed.
+ */
+obj_t *obj_move(obj_t *o)
+{
+	return _obj_clone(o, true);
 }
 
 static inline bool obj_can_merge_two_lines(obj_t *o1, obj_t *o2,
@@ -1141,47 +1144,415 @@ static inline bool obj_can_merge_two_lines(obj_t *o1, obj_t *o2,
 	return false;
 }
 
-obj_t *obj_merge(obj_t *o1, obj_t *o2, unsigned int flags)
+/*
+ * Check if obj_merge() can merge the tree o2 into o1, without modifying
+ * or allocating anything.
+ */
+bool obj_can_merge(obj_t *o1, obj_t *o2, unsigned int flags)
 {
-	obj_t *merged_ptr;
-	obj_list_head_t *merged_members;
-	obj_t *res = NULL;
+	obj_t **l1;
+	obj_t **l2;
 
 	if (o1 == NULL || o2 == NULL)
-		return NULL;
+		return false;
+
+	if (o1 == o2)
+		return true;
 
 	if (!obj_can_merge_two_lines(o1, o2, flags))
-		goto no_merge;
+		return false;
+
+	/* The children of o2 are dropped if o1 has none */
+	if (o1->ptr && !obj_can_merge(o1->ptr, o2->ptr, flags))
+		return false;
+
+	if (o1->member_list == NULL)
+		return true;
+
+	if (o2->member_list == NULL || o1->member_list->cnt == 0 ||
+	    o1->member_list->cnt != o2->member_list->cnt)
+		return false;
+
+	l1 = o1->member_list->members;
+	l2 = o2->member_list->members;
+
+	for (; *l1; l1++, l2++) {
+		if (!obj_can_merge(*l1, *l2, flags))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Replace the declaration o1 by the node o2, without its children
+ */
+static void obj_replace_declaration(obj_t *o1, obj_t *o2)
+{
+	obj_t *parent = o1->parent;
+
+	*o1 = *o2;
+
+	o1->parent = parent;
+	o1->ptr = NULL;
+	o1->member_list = NULL;
+	o1->is_shared = false;
+
+	/* Depend on the same record, next to o2 */
+	if (o2->type == __type_reffile && ilist_linked(&o2->depend_link))
+		ilist_add(&o2->depend_link, &o1->depend_link);
+}
+
+/*
+ * Merge the tree o2 into o1 in place, the trees must have been checked by
+ * obj_can_merge(). The merged tree keeps the nodes of o1, except for its
+ * declarations, which are replaced by the matching nodes of o2.
+ */
+void obj_merge(obj_t *o1, obj_t *o2)
+{
+	obj_t **l1;
+	obj_t **l2;
 
-	merged_ptr = obj_merge(o1->ptr, o2->ptr, flags);
-	if (o1->ptr && !merged_ptr)
-		goto no_merge_ptr;
+	/* Nothing to replace in the shared subtrees */
+	if (o1 == o2 || o1->is_shared)
+		return;
+
+	if (obj_is_declaration(o1)) {
+		if (o2->type != __type_reffile ||
+		    o2->ref_record != o1->ref_record)
+			obj_replace_declaration(o1, o2);
+		return;
+	}
+
+	if (o1->ptr)
+		obj_merge(o1->ptr, o2->ptr);
+
+	if (o1->member_list == NULL)
+		return;
+
+	l1 = o1->member_list->members;
+	l2 = o2->member_list->members;
+
+	for (; *l1 && *l2; l1++, l2++)
+		obj_merge(*l1, *l2);
+}
+
+/*
+ * Check if obj_merge() would modify o1, that is if o1 has a declaration
+ * where o2 has something else.
+ */
+bool obj_merge_changes(obj_t *o1, obj_t *o2)
+{
+	obj_t **l1;
+	obj_t **l2;
 
-	merged_members = obj_members_merge(o1->member_list,
-					   o2->member_list,
-					   flags);
-	if (o1->member_list && !merged_members)
-		goto no_merge_members;
+	if (o1 == o2 || o1->is_shared)
+		return false;
 
 	if (obj_is_declaration(o1))
-		res = obj_copy(o2);
-	else
-		res = obj_copy(o1);
+		return o2->type != __type_reffile ||
+			o2->ref_record != o1->ref_record;
+
+	if (o1->ptr && obj_merge_changes(o1->ptr, o2->ptr))
+		return true;
 
-	res->ptr = merged_ptr;
+	if (o1->member_list == NULL)
+		return false;
+
+	l1 = o1->member_list->members;
+	l2 = o2->member_list->members;
+
+	for (; *l1 && *l2; l1++, l2++) {
+		if (obj_merge_changes(*l1, *l2))
+			return true;
+	}
+
+	return false;
+}
+
+static uint64_t hash_str(uint64_t hash, const char *s)
+{
+	if (s == NULL)
+		return fnv1a_64(hash, "", 1);
+	return fnv1a_64(hash, s, strlen(s) + 1);
+}
 
-	if (merged_members != NULL)
-		merged_members->object = res;
-	res->member_list = merged_members;
+static uint64_t hash_num(uint64_t hash, uint64_t num)
+{
+	return fnv1a_64(hash, &num, sizeof(num));
+}
+
+/*
+ * Structural hash of the tree, computed bottom up from the fields
+ * obj_eq() compares. The references all hash the same, whatever record
+ * they point to, since with MERGE_FLAG_DECL_MERGE a declaration merges
+ * with a reference to any other type. The RH_KABI_HIDE nodes merge with
+ * each other whatever they contain.
+ * The hash only groups the candidates for merging, obj_can_merge() is
+ * what decides if two trees can be merged.
+ */
+uint64_t obj_hash(obj_t *o)
+{
+	uint64_t hash = FNV1A_64_INIT;
+	obj_t **l;
+
+	if (o == NULL)
+		return hash;
+
+	hash = hash_num(hash, o->type);
+
+	if (o->type == __type_reffile)
+		return hash;
+
+	if (obj_is_kabi_hide(o))
+		return hash_str(FNV1A_64_INIT, RH_KABI_HIDE);
+
+	hash = hash_str(hash, o->name);
+	hash = hash_str(hash, o->base_type);
+	hash = hash_str(hash, o->ns);
+	hash = hash_num(hash, o->alignment);
+	hash = hash_num(hash, o->byte_size);
+	if (has_constant(o))
+		hash = hash_num(hash, o->constant);
+	if (has_index(o))
+		hash = hash_num(hash, o->index);
+	hash = hash_num(hash, is_bitfield(o));
+	if (is_bitfield(o)) {
+		hash = hash_num(hash, o->first_bit);
+		hash = hash_num(hash, o->last_bit);
+	}
+
+	hash = hash_num(hash, o->ptr != NULL);
+	if (o->ptr != NULL)
+		hash = hash_num(hash, obj_hash(o->ptr));
+
+	hash = hash_num(hash, o->member_list != NULL);
+	if (o->member_list != NULL) {
+		for (l = o->member_list->members; *l; l++)
+			hash = hash_num(hash, obj_hash(*l));
+	}
+
+	return hash;
+}
+
+/*
+ * The shared copies of the immutable subtrees, that is the subtrees
+ * without any reffile. A shared node only has shared children, so two
+ * subtrees are the same if their roots have the same fields and the same
+ * children. The shared copies live until obj_shared_free().
+ */
+#define	OBJ_SHARED_SHARDS	64
+#define	OBJ_SHARED_MIN_SIZE	64
+#define	OBJ_SHARED_CHUNK_SIZE	4096
+
+static struct obj_shared_shard {
+	pthread_mutex_t lock;
+	obj_t **slots;
+	size_t size;		/* Power of two, or 0 before the first object */
+	size_t count;
+	struct arena arena;
+} obj_shared[OBJ_SHARED_SHARDS];
+
+void obj_shared_init(void)
+{
+	int i;
+
+	for (i = 0; i < OBJ_SHARED_SHARDS; i++) {
+		struct obj_shared_shard *shard = &obj_shared[i];
+
+		pthread_mutex_init(&shard->lock, NULL);
+		shard->slots = NULL;
+		shard->size = shard->count = 0;
+		arena_init(&shard->arena, OBJ_SHARED_CHUNK_SIZE);
+	}
+}
+
+void obj_shared_free(void)
+{
+	int i;
+
+	for (i = 0; i < OBJ_SHARED_SHARDS; i++) {
+		struct obj_shared_shard *shard = &obj_shared[i];
+
+		arena_free(&shard->arena);
+		free(shard->slots);
+		pthread_mutex_destroy(&shard->lock);
+	}
+}
+
+/* Hash of the fields of the node and of the identities of its children */
+static uint64_t obj_shared_hash(obj_t *o)
+{
+	uint64_t hash = FNV1A_64_INIT;
+	obj_t **l;
+
+	hash = hash_num(hash, o->type);
+	hash = hash_num(hash, (uintptr_t)o->name);
+	hash = hash_num(hash, (uintptr_t)o->base_type);
+	hash = hash_num(hash, o->alignment);
+	hash = hash_num(hash, o->byte_size);
+	hash = hash_num(hash, o->is_bitfield);
+	hash = hash_num(hash, o->first_bit);
+	hash = hash_num(hash, o->last_bit);
+	hash = hash_num(hash, o->constant);
+	hash = hash_num(hash, (uintptr_t)o->ptr);
+	hash = hash_num(hash, o->member_list != NULL);
+	for (l = obj_members(o); *l; l++)
+		hash = hash_num(hash, (uintptr_t)*l);
+
+	return hash;
+}
+
+static bool obj_shared_eq(obj_t *o1, obj_t *o2)
+{
+	obj_t **l1;
+	obj_t **l2;
+
+	if (o1->type != o2->type ||
+	    o1->name != o2->name ||
+	    o1->base_type != o2->base_type ||
+	    o1->alignment != o2->alignment ||
+	    o1->byte_size != o2->byte_size ||
+	    o1->is_bitfield != o2->is_bitfield ||
+	    o1->first_bit != o2->first_bit ||
+	    o1->last_bit != o2->last_bit ||
+	    o1->constant != o2->constant ||
+	    o1->ptr != o2->ptr ||
+	    (o1->member_list == NULL) != (o2->member_list == NULL))
+		return false;
+
+	l1 = obj_members(o1);
+	l2 = obj_members(o2);
+	for (; *l1 && *l2; l1++, l2++) {
+		if (*l1 != *l2)
+			return false;
+	}
+
+	return *l1 == *l2;
+}
+
+/* Return the slot holding the object, or the empty slot it belongs to */
+static obj_t **obj_shared_slot(struct obj_shared_shard *shard, obj_t *o,
+			       uint64_t hash)
+{
+	size_t mask = shard->size - 1;
+	size_t i;
+
+	for (i = hash & mask; shard->slots[i] != NULL; i = (i + 1) & mask) {
+		if (obj_shared_eq(shard->slots[i], o))
+			break;
+	}
+
+	return &shard->slots[i];
+}
+
+static void obj_shared_grow(struct obj_shared_shard *shard)
+{
+	obj_t **old_slots = shard->slots;
+	size_t old_size = shard->size;
+	size_t i;
+
+	shard->size = old_size ? old_size * 2 : OBJ_SHARED_MIN_SIZE;
+	shard->slots = safe_zmalloc(shard->size * sizeof(*shard->slots));
+
+	for (i = 0; i < old_size; i++) {
+		obj_t *o = old_slots[i];
+		uint64_t hash;
+
+		if (o == NULL)
+			continue;
+		hash = obj_shared_hash(o);
+		*obj_shared_slot(shard, o, hash >> 32) = o;
+	}
+
+	free(old_slots);
+}
+
+/* Copy the node to the shard, the children are shared already */
+static obj_t *obj_shared_copy(struct obj_shared_shard *shard, obj_t *o)
+{
+	obj_t *res = arena_alloc(&shard->arena, sizeof(*res));
+	size_t size;
+	unsigned int cnt;
+
+	*res = *o;
+	res->parent = NULL;
+	res->is_shared = true;
+
+	if (o->member_list == NULL)
+		return res;
+
+	/* Including the terminating NULL */
+	cnt = o->member_list->cnt;
+	size = (cnt + 1) * sizeof(o->member_list->members[0]);
+	res->member_list = arena_alloc(&shard->arena,
+				       sizeof(*res->member_list) + size);
+	res->member_list->cnt = cnt;
+	res->member_list->size = cnt;
+	memcpy(res->member_list->members, o->member_list->members, size);
+
+	return res;
+}
+
+static obj_t *obj_shared_get(obj_t *o)
+{
+	struct obj_shared_shard *shard;
+	uint64_t hash = obj_shared_hash(o);
+	obj_t **slot;
+	obj_t *res;
+
+	/* The low bits pick the shard, the high ones the slot */
+	shard = &obj_shared[hash % OBJ_SHARED_SHARDS];
+	pthread_mutex_lock(&shard->lock);
+
+	if (shard->count >= shard->size / 4 * 3)
+		obj_shared_grow(shard);
+
+	slot = obj_shared_slot(shard, o, hash >> 32);
+	if (*slot == NULL) {
+		*slot = obj_shared_copy(shard, o);
+		shard->count++;
+	}
+	res = *slot;
+
+	pthread_mutex_unlock(&shard->lock);
 
 	return res;
+}
+
+/*
+ * Replace the immutable subtrees of the tree o by their shared copies, so
+ * the same subtrees of all the records are kept once and compare by their
+ * pointers. Returns the shared copy of o if the whole tree is immutable,
+ * o otherwise. The replaced nodes are left in their arena.
+ * Only meant for the records being generated, nothing may modify the
+ * shared subtrees.
+ */
+obj_t *obj_share(obj_t *o)
+{
+	bool immutable;
+	obj_t **l;
+
+	if (o == NULL || o->is_shared)
+		return o;
+
+	immutable = o->type != __type_reffile && o->type != __type_weak &&
+		o->type != __type_assembly && o->ns == NULL;
+
+	if (o->ptr != NULL) {
+		o->ptr = obj_share(o->ptr);
+		immutable = immutable && o->ptr->is_shared;
+	}
 
-no_merge_members:
-	obj_list_free(merged_members);
-no_merge_ptr:
-	obj_free(merged_ptr);
-no_merge:
-	return NULL;
+	for (l = obj_members(o); *l; l++) {
+		*l = obj_share(*l);
+		immutable = immutable && (*l)->is_shared;
+	}
+
+	if (!immutable)
+		return o;
+
+	return obj_shared_get(o);
 }
 
 static void dump_reffile(obj_t *o, FILE *f)
@@ -1196,18 +1567,10 @@ static void dump_reffile(obj_t *o, FILE *f)
 
 static void _dump_members(obj_t *o, FILE *f, void (*dumper)(obj_t *, FILE *))
 {
-	obj_list_head_t *l = o->member_list;
-	obj_list_t *list;
-
-	if (l == NULL)
-		return;
-
-	list = l->first;
+	obj_t **list;
 
-	while (list) {
-		dumper(list->member, f);
-		list = list->next;
-	}
+	for (list = obj_members(o); *list; list++)
+		dumper(*list, f);
 }
 
 static void dump_arg(obj_t *o, FILE *f)
@@ -1352,12 +1715,11 @@ void obj_dump(obj_t *o, FILE *f)
 	dumpers[o->type].dumper(o, f);
 }
 
-bool obj_same_declarations(obj_t *o1, obj_t *o2,
-			   struct set *processed)
+bool obj_same_declarations(obj_t *o1, obj_t *o2, uint64_t epoch)
 {
 	const int ignore_versions = true;
-	obj_list_t *list1;
-	obj_list_t *list2;
+	obj_t **list1;
+	obj_t **list2;
 
 	if (o1 == o2)
 		return true;
@@ -1374,35 +1736,26 @@ bool obj_same_declarations(obj_t *o1, obj_t *o2,
 
 	if (o1->type == __type_reffile &&
 	    !record_same_declarations(o1->ref_record, o2->ref_record,
-				      processed)) {
+				      epoch)) {
 		return false;
 	}
 
 	if (o1->ptr &&
-	    !obj_same_declarations(o1->ptr, o2->ptr, processed)) {
+	    !obj_same_declarations(o1->ptr, o2->ptr, epoch)) {
 		return false;
 	}
 
 	if (o1->member_list) {
-		list1 = o1->member_list->first;
-		list2 = o2->member_list->first;
+		/* different member_list lengths */
+		if (o1->member_list->cnt != o2->member_list->cnt)
+			return false;
 
-		while (list1) {
-			if (list2 == NULL)
-				return false;
+		list1 = o1->member_list->members;
+		list2 = o2->member_list->members;
 
-			if (!obj_same_declarations(list1->member,
-						   list2->member,
-						   processed))
+		for (; *list1; list1++, list2++) {
+			if (!obj_same_declarations(*list1, *list2, epoch))
 				return false;
-
-			list1 = list1->next;
-			list2 = list2->next;
-		}
-
-		if (list1 != list2) {
-			/* different member_list lengths */
-			return false;
 		}
 	}
 
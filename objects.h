@@ -23,6 +23,7 @@
 #define _OBJECTS_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #include "list.h"
@@ -34,7 +35,9 @@
 #define debug(args...)
 #endif
 
-struct set;
+/* The first chunk of the arena of a tree, most of the trees are small */
+#define	OBJ_ARENA_CHUNK_SIZE	512
+
 
 enum merge_flag {
 	MERGE_DEFAULT = 0,
@@ -63,16 +66,18 @@ typedef enum {
 } obj_types;
 
 struct obj;
+
+/*
+ * Members of an object, kept in an array so they can be walked without
+ * chasing pointers. The array is NULL terminated, and it's reallocated as
+ * it grows, so it must not be shared before it's complete.
+ */
 typedef struct obj_list {
-	struct obj *member;
-	struct obj_list *next;
+	unsigned int cnt;
+	unsigned int size;
+	struct obj *members[];
 } obj_list_t;
 
-typedef struct obj_list_head {
-	obj_list_t *first, *last;
-	struct obj *object;
-} obj_list_head_t;
-
 /*
  * Structure representing symbols. Several field are overloaded.
  *
@@ -80,6 +85,8 @@ typedef struct obj_list_head {
  *		type...)
  * is_bitfield:	(var) It's a bitfield
  * first_bit, last_bit:	(var) bit range within the offset.
+ * is_shared:	the object is the shared copy of an immutable subtree, see
+ *		obj_share(); it has no parent.
  * name:	name of the symbol
  * ref_record:	(reffile) pointer to the referenced record (only while
  *              generating records, otherwise base_type with string is used)
@@ -97,15 +104,15 @@ typedef struct obj_list_head {
  * index:	(array) index of array
  * link:	(weak) weak alias link
  * offset:	(var) offset of a struct member
- * depend_rec_node:	(reffile) node from dependents field of record where
- *			this obj references.
+ * depend_link:	(reffile) link in the dependents of the record this obj
+ *		references.
  *
  * Note the dual parent/child relationship with the n-ary member_list and the
  * the unary ptr. Only functions uses both.
  */
 typedef struct obj {
 	obj_types type;
-	unsigned char is_bitfield, first_bit, last_bit;
+	unsigned char is_bitfield, first_bit, last_bit, is_shared;
 	union {
 		const char *name;
 		struct record *ref_record;
@@ -113,18 +120,26 @@ typedef struct obj {
 	const char *base_type;
 	unsigned alignment;
 	unsigned int byte_size;
-	obj_list_head_t *member_list;
+	obj_list_t *member_list;
 	struct obj *ptr, *parent;
 	union {
 		unsigned long constant;
 		unsigned long index;
-		char *link;
+		const char *link;
 		unsigned long offset;
-		struct list_node *depend_rec_node;
+		struct ilist depend_link;
 	};
 	char *ns;
 } obj_t;
 
+/* The NULL terminated members of the object */
+static inline obj_t **obj_members(obj_t *o)
+{
+	static obj_t *no_members[] = { NULL };
+
+	return o->member_list ? o->member_list->members : no_members;
+}
+
 static inline bool has_offset(obj_t *o)
 {
 	return o->type == __type_struct_member;
@@ -210,10 +225,11 @@ typedef enum {
 typedef int cb_t(obj_t *o, void *args);
 
 obj_list_t *obj_list_new(obj_t *obj);
-obj_list_head_t *obj_list_head_new(obj_t *obj);
-void obj_list_add(obj_list_head_t *head, obj_t *obj);
-void obj_free(obj_t *o);
+obj_list_t *obj_list_add(obj_list_t *list, obj_t *obj);
+void obj_detach(obj_t *o);
+struct arena *obj_arena_set(struct arena *arena);
 
+obj_t *obj_new(obj_types type, char *name);
 obj_t *obj_struct_new(char *name);
 obj_t *obj_union_new(char *name);
 obj_t *obj_enum_new(char *name);
@@ -241,12 +257,20 @@ int obj_walk_tree3(obj_t *o, cb_t cb_pre, cb_t cb_in, cb_t cb_post,
 
 int obj_hide_kabi(obj_t *root, bool show_new_field);
 
-obj_t *obj_parse(FILE *file, char *fn);
-obj_t *obj_merge(obj_t *o1, obj_t *o2, unsigned int flags);
+obj_t *obj_parse(FILE *file, char *fn, struct arena *arena);
+bool obj_can_merge(obj_t *o1, obj_t *o2, unsigned int flags);
+void obj_merge(obj_t *o1, obj_t *o2);
+bool obj_merge_changes(obj_t *o1, obj_t *o2);
+obj_t *obj_clone(obj_t *o);
+obj_t *obj_move(obj_t *o);
+void obj_shared_init(void);
+void obj_shared_free(void);
+obj_t *obj_share(obj_t *o);
 void obj_dump(obj_t *o, FILE *f);
 
 bool obj_eq(obj_t *o1, obj_t *o2, bool ignore_versions);
+uint64_t obj_hash(obj_t *o);
 
-bool obj_same_declarations(obj_t *o1, obj_t *o2, struct set *processed);
+bool obj_same_declarations(obj_t *o1, obj_t *o2, uint64_t epoch);
 
 #endif
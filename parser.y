@@ -46,7 +46,7 @@
 	void *ptr;
 	char *str;
 	obj_t *obj;
-	obj_list_head_t *list;
+	obj_list_t *list;
 }
 
 %token <str> IDENTIFIER STRING SRCFILE
@@ -255,12 +255,11 @@ struct_type:
 struct_list:
 	struct_elt
 	{
-	    $$ = obj_list_head_new($struct_elt);
+	    $$ = obj_list_new($struct_elt);
 	}
 	| struct_list NEWLINE struct_elt
 	{
-	    obj_list_add($1, $struct_elt);
-	    $$ = $1;
+	    $$ = obj_list_add($1, $struct_elt);
 	}
 	;
 
@@ -310,7 +309,6 @@ union_type:
 	{
 	    $$ = obj_union_new($IDENTIFIER);
 	    $$->member_list = $elt_list;
-	    $elt_list->object = $$;
 	}
 	;
 
@@ -319,19 +317,17 @@ enum_type:
 	{
 	    $$ = obj_enum_new($IDENTIFIER);
 	    $$->member_list = $enum_list;
-	    $enum_list->object = $$;
 	}
 	;
 
 enum_list:
 	enum_elt
 	{
-	    $$ = obj_list_head_new($enum_elt);
+	    $$ = obj_list_new($enum_elt);
 	}
 	| enum_list NEWLINE enum_elt
 	{
-	    obj_list_add($1, $enum_elt);
-	    $$ = $1;
+	    $$ = obj_list_add($1, $enum_elt);
 	}
 	;
 
@@ -349,8 +345,6 @@ func_type:
 	    check_and_free_keyword($1, "func");
 	    $$ = obj_func_new_add($2, $type);
 	    $$->member_list = $arg_list;
-	    if ($arg_list)
-		    $arg_list->object = $$;
 	}
 	| IDENTIFIER reference_file /* protype define as typedef */
 	{
@@ -370,8 +364,7 @@ arg_list:
 	}
 	| elt_list NEWLINE variable_var_list NEWLINE
 	{
-	    obj_list_add($elt_list, $variable_var_list);
-	    $$ = $elt_list;
+	    $$ = obj_list_add($elt_list, $variable_var_list);
 	}
 	;
 
@@ -386,12 +379,11 @@ variable_var_list:
 elt_list:
 	elt
 	{
-	    $$ = obj_list_head_new($elt);
+	    $$ = obj_list_new($elt);
 	}
 	| elt_list NEWLINE elt
 	{
-	    obj_list_add($1, $elt);
-	    $$ = $1;
+	    $$ = obj_list_add($1, $elt);
 	}
 	;
 
@@ -472,7 +464,7 @@ weak_symbol:
 	{
 		check_and_free_keyword($1, "weak");
 		$$ = obj_weak_new($2);
-		$$->link = $4;
+		$$->link = global_string_get_move($4);
 	}
 	;
 
@@ -481,7 +473,9 @@ weak_symbol:
 
 extern void usage(void);
 
-obj_t *obj_parse(FILE *file, char *fn) {
+/* The objects of the file are allocated from the arena */
+obj_t *obj_parse(FILE *file, char *fn, struct arena *arena) {
+	struct arena *prev;
 	obj_t *root = NULL;
 
 #ifdef DEBUG
@@ -491,7 +485,9 @@ obj_t *obj_parse(FILE *file, char *fn) {
 #endif
 
 	yyin = file;
+	prev = obj_arena_set(arena);
 	yyparse(&root);
+	obj_arena_set(prev);
 	if (!root)
 		fail("No object build for file %s\n", fn);
 
@@ -2,6 +2,7 @@
 #define RECORD_H_
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #include "list.h"
@@ -48,6 +49,8 @@
  * obj: pointer to the abstract type object, representing the toplevel type of
  *      the record.
  *
+ * arena: memory of the objects of obj, freed with the record.
+ *
  * link: name of weak link alisas for the weak aliases.
  *
  * free: type specific function to free the record
@@ -57,11 +60,22 @@
  *
  * dependents: objects that reference this record.
  *
- * list_node: node containing the record, record only belong to one list
- *            at a time(usually record_list.records)
+ * list_node: link of the record in the list it belongs to, record only
+ *            belong to one list at a time(usually record_list.records)
+ *
+ * merged: the record was merged into another one, it stays in its list
+ *         until the list is cleaned up
  *
  * failed: number of times the record could not be used for merging
+ *
+ * digest: structural hash of the origin and obj, valid if has_digest is set;
+ *         grouping hint only, obj_can_merge() decides.
+ *
+ * rec_list: the records of the db with the same key, set once the record
+ *           gets to the db
  */
+struct record_list;
+
 struct record {
 	const char *key;
 	int version;
@@ -70,13 +84,18 @@ struct record {
 	const char *origin;
 	stack_t *stack;
 	obj_t *obj;
+	struct arena arena;
 	char *link;
 	void (*free)(struct record *);
 	void (*dump)(struct record *, FILE *);
 
-	struct list dependents;
-	struct list_node *list_node;
+	struct ilist dependents;
+	struct ilist list_node;
+	bool merged;
 	unsigned int failed;
+	bool has_digest;
+	uint64_t digest;
+	struct record_list *rec_list;
 };
 
 static inline const char *record_get_key(struct record *record)
@@ -95,6 +114,16 @@ static inline bool record_is_declaration(struct record *record)
 }
 
 bool record_same_declarations(struct record *r1, struct record *r2,
-			      struct set *processed);
+			      uint64_t epoch);
+
+struct record *record_new_regular(const char *key);
+struct record *record_new_assembly(const char *key);
+struct record *record_new_weak(const char *key, const char *link);
+void record_close(struct record *rec, obj_t *obj);
+void record_put(struct record *rec);
+
+void record_dump_regular(struct record *rec, FILE *f);
+void record_dump_assembly(struct record *rec, FILE *f);
+void record_dump_weak(struct record *rec, FILE *f);
 
 #endif /* RECORD_H_ */
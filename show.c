@@ -20,13 +20,15 @@
 #include <unistd.h>
 #include "objects.h"
 #include "utils.h"
+#include "kabipack.h"
 
 struct {
 	bool debug;
 	bool hide_kabi;
 	bool hide_kabi_new;
+	struct kabipack *pack;
 	FILE *file;
-} show_config = {false, false, false, NULL};
+} show_config = {false, false, false, NULL, NULL};
 
 static void show_usage()
 {
@@ -38,6 +40,8 @@ static void show_usage()
 	       "    -n, --hide-kabi-new:\n\t\t\thide the kabi trickery made by"
 	       " RH_KABI_REPLACE, but show the new field\n"
 
+	       "    -p, --pack kabi_pack:\n\t\t\tread the kabi files from"
+	       " the kABI pack\n"
 	       "    -d, --debug:\tprint the raw tree\n"
 	       "    --no-offset:\tdon't display the offset of struct fields\n");
 	exit(1);
@@ -48,6 +52,7 @@ static void show_usage()
  */
 int show(int argc, char **argv)
 {
+	struct arena arena;
 	obj_t *root;
 	int opt, opt_index, ret = 0;
 	struct option loptions[] = {
@@ -55,13 +60,14 @@ int show(int argc, char **argv)
 		{"hide-kabi", no_argument, 0, 'k'},
 		{"hide-kabi-new", no_argument, 0, 'n'},
 		{"help", no_argument, 0, 'h'},
+		{"pack", required_argument, 0, 'p'},
 		{"no-offset", no_argument, &display_options.no_offset, 1},
 		{0, 0, 0, 0}
 	};
 
 	memset(&display_options, 0, sizeof(display_options));
 
-	while ((opt = getopt_long(argc, argv, "dknh",
+	while ((opt = getopt_long(argc, argv, "dknhp:",
 				  loptions, &opt_index)) != -1) {
 		switch (opt) {
 		case 0:
@@ -75,6 +81,11 @@ int show(int argc, char **argv)
 		case 'k':
 			show_config.hide_kabi = true;
 			break;
+		case 'p':
+			show_config.pack = kabipack_open(optarg);
+			if (show_config.pack == NULL)
+				fail("Not a kABI pack: %s\n", optarg);
+			break;
 		case 'h':
 		default:
 			show_usage();
@@ -87,9 +98,18 @@ int show(int argc, char **argv)
 	while (optind < argc) {
 		char *fn = argv[optind++];
 
-		show_config.file = safe_fopen(fn);
+		if (show_config.pack != NULL) {
+			ssize_t i = kabipack_find(show_config.pack, fn);
+
+			if (i == -1)
+				fail("Failed to open kABI file: %s\n", fn);
+			show_config.file = kabipack_fopen(show_config.pack, i);
+		} else {
+			show_config.file = safe_fopen(fn);
+		}
 
-		root = obj_parse(show_config.file, fn);
+		arena_init(&arena, OBJ_ARENA_CHUNK_SIZE);
+		root = obj_parse(show_config.file, fn, &arena);
 
 		if (show_config.hide_kabi)
 			obj_hide_kabi(root, show_config.hide_kabi_new);
@@ -101,9 +121,12 @@ int show(int argc, char **argv)
 		if (optind < argc)
 			putchar('\n');
 
-		obj_free(root);
+		arena_free(&arena);
 		fclose(show_config.file);
 	}
 
+	if (show_config.pack != NULL)
+		kabipack_free(show_config.pack);
+
 	return ret;
 }
@@ -0,0 +1,111 @@
+/*
+	Copyright(C) 2016, Red Hat, Inc., Stanislav Kozina
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * A trivial pool of worker threads processing an array of work items.
+ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "utils.h"
+#include "threadpool.h"
+
+struct threadpool {
+	pthread_t *threads;
+	unsigned int nthreads;
+	pthread_mutex_t lock;
+	size_t next; /* Next index to hand out */
+	size_t count;
+	void (*fn)(size_t, void *);
+	void *arg;
+};
+
+static bool threadpool_next(struct threadpool *pool, size_t *idx)
+{
+	bool ret = false;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->next < pool->count) {
+		*idx = pool->next++;
+		ret = true;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return ret;
+}
+
+static void *threadpool_worker(void *arg)
+{
+	struct threadpool *pool = arg;
+	size_t idx;
+
+	while (threadpool_next(pool, &idx))
+		pool->fn(idx, pool->arg);
+
+	return NULL;
+}
+
+struct threadpool *threadpool_start(unsigned int nthreads, size_t count,
+				    void (*fn)(size_t, void *), void *arg)
+{
+	struct threadpool *pool = safe_zmalloc(sizeof(*pool));
+	unsigned int i;
+	int rc;
+
+	if (nthreads > count)
+		nthreads = count;
+	if (nthreads == 0)
+		nthreads = 1;
+
+	pool->threads = safe_zmalloc(nthreads * sizeof(*pool->threads));
+	pool->nthreads = nthreads;
+	pool->count = count;
+	pool->fn = fn;
+	pool->arg = arg;
+	pthread_mutex_init(&pool->lock, NULL);
+
+	for (i = 0; i < nthreads; i++) {
+		rc = pthread_create(&pool->threads[i], NULL,
+				    threadpool_worker, pool);
+		if (rc != 0)
+			fail("pthread_create() failed: %s\n", strerror(rc));
+	}
+
+	return pool;
+}
+
+void threadpool_cancel(struct threadpool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->count = pool->next;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void threadpool_join(struct threadpool *pool)
+{
+	unsigned int i;
+
+	for (i = 0; i < pool->nthreads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->threads);
+	free(pool);
+}
@@ -0,0 +1,37 @@
+/*
+	Copyright(C) 2016, Red Hat, Inc., Stanislav Kozina
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef THREADPOOL_H_
+#define	THREADPOOL_H_
+
+#include <stddef.h>
+
+struct threadpool;
+
+/*
+ * Run fn(index, arg) for every index in [0, count) on nthreads worker
+ * threads. Indexes are handed out in increasing order.
+ */
+extern struct threadpool *threadpool_start(unsigned int nthreads, size_t count,
+					   void (*fn)(size_t, void *),
+					   void *arg);
+/* Don't hand out any more indexes, the running ones are finished normally */
+extern void threadpool_cancel(struct threadpool *);
+/* Wait for all the workers to finish and free the pool */
+extern void threadpool_join(struct threadpool *);
+
+#endif /* THREADPOOL_H_ */
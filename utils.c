@@ -30,10 +30,10 @@
 #include <dirent.h>
 #include <assert.h>
 #include <libgen.h> /* dirname() */
+#include <pthread.h>
 
 #include "main.h"
 #include "utils.h"
-#include "hash.h"
 
 /*
  * Sort function for scandir.
@@ -417,48 +417,234 @@ char *filenametosymbol(const char *filename)
 	return name;
 }
 
-struct hash *global_string_keeper;
+#define	ARENA_ALIGN		8
+#define	ARENA_CHUNK_MAX_SIZE	(1 << 20)
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	char data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+void arena_init(struct arena *arena, size_t chunk_size)
+{
+	arena->chunks = NULL;
+	arena->chunk_size = chunk_size;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	struct arena_chunk *chunk = arena->chunks;
+	void *result;
+
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+	if (chunk == NULL || chunk->size - chunk->used < size) {
+		size_t chunk_size = arena->chunk_size;
+
+		/* Start small, but get bigger as the arena keeps growing */
+		if (chunk != NULL) {
+			chunk_size = chunk->size;
+			if (chunk_size < ARENA_CHUNK_MAX_SIZE)
+				chunk_size *= 2;
+		}
+		if (chunk_size < size)
+			chunk_size = size;
+
+		chunk = safe_realloc(NULL, sizeof(*chunk) + chunk_size);
+		chunk->size = chunk_size;
+		chunk->used = 0;
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+	}
+
+	result = chunk->data + chunk->used;
+	chunk->used += size;
+
+	return result;
+}
+
+void arena_free(struct arena *arena)
+{
+	struct arena_chunk *chunk, *next;
+
+	for (chunk = arena->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+
+	arena->chunks = NULL;
+}
+
+/*
+ * The string keeper is shared by all the generate workers, so it is split
+ * into independently locked shards to keep the lock contention low.
+ *
+ * Every shard copies its strings into an arena, each string preceded by
+ * its length and hash, and finds them through an open addressing table of
+ * pointers into the arena. The hash is computed once per lookup and picks
+ * both the shard and the slot. Nothing is allocated before the first
+ * string comes in, and the kept strings are never freed one by one.
+ */
+#define	STRING_KEEPER_SHARDS	64
+#define	STRING_TABLE_MIN_SIZE	64
+#define	STRING_ARENA_CHUNK_SIZE	4096
+
+struct kept_string {
+	uint32_t len;
+	uint32_t hash;
+	char str[];
+};
+
+struct string_interner {
+	struct kept_string **slots;
+	size_t size;		/* Power of two, or 0 before the first string */
+	size_t count;
+	struct arena arena;
+};
+
+static struct string_keeper_shard {
+	pthread_mutex_t lock;
+	struct string_interner interner;
+} global_string_keeper[STRING_KEEPER_SHARDS];
+
+/* Return the slot holding the string, or the empty slot it belongs to */
+static struct kept_string **string_interner_slot(struct string_interner *si,
+						 const char *string,
+						 uint32_t len, uint32_t hash)
+{
+	size_t mask = si->size - 1;
+	size_t i;
+
+	for (i = hash & mask; si->slots[i] != NULL; i = (i + 1) & mask) {
+		struct kept_string *ks = si->slots[i];
+
+		if (ks->hash == hash && ks->len == len &&
+		    memcmp(ks->str, string, len) == 0)
+			break;
+	}
+
+	return &si->slots[i];
+}
+
+static void string_interner_grow(struct string_interner *si)
+{
+	struct kept_string **old_slots = si->slots;
+	size_t old_size = si->size;
+	size_t i;
+
+	si->size = old_size ? old_size * 2 : STRING_TABLE_MIN_SIZE;
+	si->slots = safe_zmalloc(si->size * sizeof(*si->slots));
+
+	for (i = 0; i < old_size; i++) {
+		struct kept_string *ks = old_slots[i];
+		size_t j;
+
+		if (ks == NULL)
+			continue;
+		for (j = ks->hash & (si->size - 1); si->slots[j] != NULL;
+		     j = (j + 1) & (si->size - 1))
+			;
+		si->slots[j] = ks;
+	}
+
+	free(old_slots);
+}
+
+static const char *string_interner_get(struct string_interner *si,
+				       const char *string, uint32_t len,
+				       uint32_t hash)
+{
+	struct kept_string **slot;
+	struct kept_string *ks;
+
+	if (si->count >= si->size / 4 * 3)
+		string_interner_grow(si);
+
+	slot = string_interner_slot(si, string, len, hash);
+	if (*slot != NULL)
+		return (*slot)->str;
+
+	ks = arena_alloc(&si->arena, sizeof(*ks) + len + 1);
+	ks->len = len;
+	ks->hash = hash;
+	memcpy(ks->str, string, len + 1);
+
+	*slot = ks;
+	si->count++;
+
+	return ks->str;
+}
+
+static void string_interner_free(struct string_interner *si)
+{
+	arena_free(&si->arena);
+	free(si->slots);
+	si->slots = NULL;
+	si->size = si->count = 0;
+}
 
 void global_string_keeper_init(void)
 {
-	global_string_keeper = hash_new(1 << 20, free);
+	int i;
+
+	for (i = 0; i < STRING_KEEPER_SHARDS; i++) {
+		struct string_keeper_shard *shard = &global_string_keeper[i];
+
+		pthread_mutex_init(&shard->lock, NULL);
+		memset(&shard->interner, 0, sizeof(shard->interner));
+		arena_init(&shard->interner.arena, STRING_ARENA_CHUNK_SIZE);
+	}
 }
 
 void global_string_keeper_free(void)
 {
-	hash_free(global_string_keeper);
+	int i;
+
+	for (i = 0; i < STRING_KEEPER_SHARDS; i++) {
+		struct string_keeper_shard *shard = &global_string_keeper[i];
+
+		string_interner_free(&shard->interner);
+		pthread_mutex_destroy(&shard->lock);
+	}
 }
 
 const char *global_string_get_copy(const char *string)
 {
+	struct string_keeper_shard *shard;
 	const char *result;
+	uint64_t hash;
+	size_t len;
 
 	if (string == NULL)
 		return NULL;
 
-	result = hash_find(global_string_keeper, string);
-	if (result == NULL) {
-		result = safe_strdup(string);
-		hash_add(global_string_keeper, result, result);
-	}
+	len = strlen(string);
+	if (len > UINT32_MAX)
+		fail("String too long to be kept\n");
+	hash = fnv1a_64(FNV1A_64_INIT, string, len);
+
+	/* The low bits pick the shard, the high ones the slot */
+	shard = &global_string_keeper[hash % STRING_KEEPER_SHARDS];
+	pthread_mutex_lock(&shard->lock);
+	result = string_interner_get(&shard->interner, string, len,
+				     hash >> 32);
+	pthread_mutex_unlock(&shard->lock);
 
 	return result;
 }
 
+/*
+ * Like global_string_get_copy(), but takes over the string, which is freed
+ * once its content is kept.
+ */
 const char *global_string_get_move(char *string)
 {
 	const char *result;
 
-	if (string == NULL)
-		return NULL;
-
-	result = hash_find(global_string_keeper, string);
-	if (result == NULL) {
-		result = string;
-		hash_add(global_string_keeper, result, result);
-	} else {
-		free(string);
-	}
+	result = global_string_get_copy(string);
+	free(string);
 
 	return result;
 }
@@ -21,6 +21,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
 
@@ -98,6 +99,21 @@ static inline bool safe_streq(const char *s1, const char *s2)
 	return true;
 }
 
+#define	FNV1A_64_INIT	14695981039346656037ULL
+
+/* Continue the FNV-1a hash with the data */
+static inline uint64_t fnv1a_64(uint64_t hash, const void *data, size_t size)
+{
+	const unsigned char *p = data;
+
+	while (size-- > 0) {
+		hash ^= *p++;
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
 static inline bool safe_strendswith(const char *s1, const char *s2)
 {
 	int len1, len2;
@@ -155,6 +171,22 @@ extern char *path_normalize(char *);
 extern char *filenametotype(const char *);
 extern char *filenametosymbol(const char *);
 
+/*
+ * Region allocator, the memory is carved out of chunks which are all freed
+ * at once by arena_free(). The first chunk has chunk_size bytes, the next
+ * ones get bigger as the arena grows.
+ */
+struct arena_chunk;
+
+struct arena {
+	struct arena_chunk *chunks;
+	size_t chunk_size;
+};
+
+extern void arena_init(struct arena *arena, size_t chunk_size);
+extern void *arena_alloc(struct arena *arena, size_t size);
+extern void arena_free(struct arena *arena);
+
 extern void global_string_keeper_init(void);
 extern void global_string_keeper_free(void);
 extern const char *global_string_get_copy(const char *string);